@@ -0,0 +1,236 @@
+#include "host.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* ******************************************************************
+ Latency and timing benchmarks for the firmware, run on the host.
+
+   Each scenario scripts button presses (with contact bounce) against
+   the firmware in simulated time and reads the captured motor and LED
+   outputs afterwards:
+     enter to feedback   enter press to the keyboard motor starting
+     send to first element   send press to the morse motor starting
+     morse timing        every on and off period of a played message
+                         against the ideal for its WPM and Farnsworth
+                         speed, and the LED against the motor
+     keystroke rate      the fastest steady typing rate at which every
+                         character still reaches the message
+   Simulated time does not include CPU time, so the latencies are those
+   the firmware's own timing (debounce, scheduling) gives, and the morse
+   errors can only show logic errors, never timer or interrupt jitter,
+   since every timer fires exactly when it is due. Each scenario
+   runs in its own process, since the firmware's state is global.
+
+   Build and run:
+     make
+     ./bench [bounces]      (contact bounces per edge, default 5)
+**********************************************************************/
+
+//Firmware symbols the scenarios use
+extern char msg[];
+extern int len;
+void morseSpeed(int wpm, int farnsworth);
+
+#define MS 1000ULL  //microseconds per millisecond
+
+//Bump pins in BusIn order, so bit i of a cell is bumpPins[i]
+const PinName bumpPins[6] = {PC_12, PC_11, PC_10, PC_9, PC_8, PC_6};
+
+//Cells for a to j, which the keystroke scenarios type in turn
+const int letterCells[10] = {0b100000, 0b110000, 0b100100, 0b100110, 0b100010,
+                             0b110100, 0b110110, 0b110010, 0b010100, 0b010110};
+
+int bounces = 5;    //contact bounces per edge
+
+//Min, mean and max of a set of samples
+struct Stats {
+    int count = 0;
+    double sum = 0, min = 0, max = 0;
+    void add(double x) {
+        if (count == 0 || x < min) min = x;
+        if (count == 0 || x > max) max = x;
+        sum += x;
+        count++;
+    }
+    double mean() const { return count > 0 ? sum / count : 0; }
+};
+
+//Types one cell: holds the bumps, presses enter partway through, then lets go of the bumps
+void typeCell(uint64_t at, int cell, uint64_t period) {
+    for (int i = 0; i < 6; i++) {
+        if (cell & (1 << i)) host::press(bumpPins[i], at, period * 8 / 10, bounces);
+    }
+    host::press(PB_15, at + period * 2 / 10, period * 4 / 10, bounces);
+}
+
+//Time of the first rising edge of an output pin at or after a time, or 0 if there is none
+uint64_t firstRise(PinName pin, uint64_t after) {
+    for (const host::Edge &e : host::edges()) {
+        if (e.pin == pin && e.level == 1 && e.time >= after) return e.time;
+    }
+    return 0;
+}
+
+//Runs a scenario in a child process, so it starts from fresh firmware state
+void runScenario(std::function<void()> scenario) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        scenario();
+        if (host::watchdogExpired() != 0) printf("watchdog ran out at %.1fms\n", host::watchdogExpired() / 1000.0);
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) printf("scenario failed (status %d)\n", status);
+}
+
+//Latency from each enter press to the keyboard motor starting
+void enterToFeedback() {
+    const int presses = 20;
+    const uint64_t period = 300 * MS;
+    for (int i = 0; i < presses; i++) typeCell((i + 1) * period, letterCells[i % 10], period);
+    host::start((presses + 2) * period);
+    Stats ms;
+    for (int i = 0; i < presses; i++) {
+        uint64_t pressed = (i + 1) * period + period * 2 / 10;
+        uint64_t felt = firstRise(PE_14, pressed);
+        if (felt != 0) ms.add((felt - pressed) / 1000.0);
+    }
+    printf("%-22s %8d %8.2f %8.2f %8.2f\n", "enter to feedback", ms.count, ms.min, ms.mean(), ms.max);
+}
+
+//Latency from each send press to the first morse element
+void sendToFirstElement() {
+    const int rounds = 10;
+    const uint64_t period = 1500 * MS;
+    for (int i = 0; i < rounds; i++) {
+        uint64_t at = (i + 1) * period;
+        typeCell(at, letterCells[4], 200 * MS);     //e, a single dot
+        host::press(PB_12, at + 400 * MS, 100 * MS, bounces);
+    }
+    host::start((rounds + 2) * period);
+    Stats ms;
+    for (int i = 0; i < rounds; i++) {
+        uint64_t pressed = (i + 1) * period + 400 * MS;
+        uint64_t played = firstRise(PF_8, pressed);
+        if (played != 0) ms.add((played - pressed) / 1000.0);
+    }
+    printf("%-22s %8d %8.2f %8.2f %8.2f\n", "send to first element", ms.count, ms.min, ms.mean(), ms.max);
+}
+
+//Ideal on and off periods of a message in microseconds, from the PARIS timing of morseSpeed()
+std::vector<uint64_t> idealPeriods(const char *text, int wpm, int farnsworth) {
+    static const char *codes[26] = {".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..", ".---", "-.-",
+                                    ".-..", "--", "-.", "---", ".--.", "--.-", ".-.", "...", "-", "..-", "...-",
+                                    ".--", "-..-", "-.--", "--.."};
+    double unit = 1.2e6 / wpm;
+    double gaps = 60e6 / farnsworth - 37.2e6 / wpm;     //the 19 gap units of a PARIS word
+    std::vector<uint64_t> periods;
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == ' ') continue;
+        for (const char *e = codes[*c - 'a']; *e != '\0'; e++) {
+            periods.push_back((uint64_t) (*e == '-' ? 3 * unit : unit));
+            if (e[1] != '\0') periods.push_back((uint64_t) unit);
+        }
+        if (c[1] == ' ') periods.push_back((uint64_t) (7 * gaps / 19));
+        else if (c[1] != '\0') periods.push_back((uint64_t) (3 * gaps / 19));
+    }
+    return periods;
+}
+
+//Plays a message and compares every on and off period of the morse motor with the ideal
+void morseTiming(int wpm, int farnsworth) {
+    const char *text = "paris paris";
+    host::at(1 * MS, [=] {
+        morseSpeed(wpm, farnsworth);
+        strcpy(msg, text);
+        len = strlen(text);
+    });
+    host::press(PB_12, 10 * MS, 50 * MS, bounces);
+    host::start(60000 * MS);
+
+    std::vector<uint64_t> motor, led;   //edge times
+    for (const host::Edge &e : host::edges()) {
+        if (e.time == 0) continue;      //outputs set up at startup
+        if (e.pin == PF_8) motor.push_back(e.time);
+        if (e.pin == PB_1) led.push_back(e.time);
+    }
+    std::vector<uint64_t> ideal = idealPeriods(text, wpm, farnsworth);
+    Stats error;    //microseconds
+    for (size_t i = 0; i + 1 < motor.size() && i < ideal.size(); i++) {
+        double actual = motor[i + 1] - motor[i];
+        error.add(actual > ideal[i] ? actual - ideal[i] : ideal[i] - actual);
+    }
+    uint64_t expected = 0;
+    for (uint64_t p : ideal) expected += p;
+    long long total = motor.size() >= 2 ? (long long) (motor.back() - motor.front()) : 0;
+    int mismatched = motor.size() == led.size() ? 0 : 1;
+    for (size_t i = 0; i < motor.size() && i < led.size(); i++) mismatched += motor[i] != led[i];
+    printf("%3d/%-3d %8zu %8zu %10.1f %10.1f %12lld %6d\n", wpm, farnsworth, motor.size() / 2, (ideal.size() + 1) / 2,
+           error.mean(), error.max, total - (long long) expected, mismatched);
+}
+
+//What a keystroke run left in the message
+struct Typed {
+    int matched = 0;    //characters at the start of the message that are the keys typed, in order
+    int length = 0;     //characters in the message
+};
+
+//Types keys at a steady rate and reports how much of them reached the message
+Typed keystrokes(int perSecond, int keys) {
+    uint64_t period = 1000000 / perSecond;
+    std::string expected;
+    for (int i = 0; i < keys; i++) {
+        typeCell((i + 1) * period, letterCells[i % 10], period);
+        expected += (char) ('a' + i % 10);
+    }
+    host::start((keys + 2) * period + 1000 * MS);
+    Typed typed;
+    while (typed.matched < len && typed.matched < keys && msg[typed.matched] == expected[typed.matched]) typed.matched++;
+    typed.length = len;
+    return typed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) bounces = atoi(argv[1]);
+    printf("contact bounces per edge: %d\n\n", bounces);
+
+    printf("%-22s %8s %8s %8s %8s\n", "latency (ms)", "samples", "min", "mean", "max");
+    runScenario(enterToFeedback);
+    runScenario(sendToFirstElement);
+
+    printf("\nmorse timing (us)\n%-7s %8s %8s %10s %10s %12s %6s\n", "wpm", "elements", "ideal", "mean err",
+           "max err", "total err", "led");
+    const int speeds[][2] = {{12, 12}, {20, 20}, {20, 10}, {5, 5}};
+    for (auto &speed : speeds) runScenario([&] { morseTiming(speed[0], speed[1]); });
+
+    printf("\nkeystroke rate (40 keys, a to j)\n%-10s %8s\n", "keys/s", "entered");
+    const int keys = 40;
+    int best = 0;
+    for (int rate = 5; rate <= 60; rate += 5) {
+        int fds[2];
+        if (pipe(fds) != 0) return 1;
+        runScenario([&] {
+            Typed typed = keystrokes(rate, keys);
+            if (write(fds[1], &typed, sizeof(typed)) != sizeof(typed)) _exit(1);
+        });
+        Typed typed;
+        if (read(fds[0], &typed, sizeof(typed)) != sizeof(typed)) typed = Typed();
+        close(fds[0]);
+        close(fds[1]);
+        printf("%-10d %8d", rate, typed.matched);
+        if (typed.length < keys) printf(" (%d lost)", keys - typed.length);
+        if (typed.length > keys) printf(" (%d extra)", typed.length - keys);
+        if (typed.matched < std::min(typed.length, keys)) printf(" (wrong from key %d)", typed.matched + 1);
+        printf("\n");
+        bool ok = typed.matched == keys && typed.length == keys;
+        if (ok && rate == best + 5) best = rate;
+    }
+    printf("max sustained keystroke rate: %d keys/s\n", best);
+    return 0;
+}
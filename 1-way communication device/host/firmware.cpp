@@ -0,0 +1,6 @@
+//The firmware, built for the host with its main() renamed so a benchmark can call it
+#include "mbed.h"
+#include <atomic>
+
+#define main device_main
+#include "../main.cpp"
@@ -0,0 +1,175 @@
+#include "host.h"
+#include <cstdarg>
+#include <map>
+#include <queue>
+#include <unordered_map>
+
+//Simulated registers
+static GPIO_TypeDef gpiob = {{}, {0, 'B'}, {}};    //ODR drives port B's pins
+static RCC_TypeDef rcc;
+GPIO_TypeDef *GPIOB = &gpiob;
+RCC_TypeDef *RCC = &rcc;
+
+FILE *host::console = nullptr;
+
+namespace {
+    //A scheduled callback
+    struct Entry {
+        std::function<void()> fn;
+        uint64_t period;    //microseconds between runs, 0 to run once
+    };
+
+    //Position of a callback in the schedule; earlier time first, then the order it was added
+    struct Slot {
+        uint64_t time;
+        uint64_t seq;
+        int id;
+        bool operator>(const Slot &other) const {
+            return time != other.time ? time > other.time : seq > other.seq;
+        }
+    };
+
+    //Simulator state, in function statics so that the firmware's global constructors,
+    //which drive pins, can run before this file's
+    struct Sim {
+        uint64_t now = 0;
+        uint64_t stop = 0;
+        uint64_t seq = 0;
+        int nextId = 1;
+        std::priority_queue<Slot, std::vector<Slot>, std::greater<Slot>> slots;
+        std::unordered_map<int, Entry> entries;    //live callbacks; cancelled ones are skipped when their slot comes up
+        int levels[PIN_COUNT] = {};
+        std::vector<std::function<void()>> rises[PIN_COUNT];
+        std::vector<host::Edge> edges;
+        uint32_t watchdogTimeout = 0;   //milliseconds, 0 until the firmware starts it
+        uint64_t watchdogKicked = 0;
+        uint64_t watchdogExpired = 0;
+    };
+
+    Sim &sim() {
+        static Sim s;
+        return s;
+    }
+
+    //Pins of GPIO port B driven by ODR, and their bits
+    const struct { PinName pin; int bit; } portBPins[] = {{PB_1, 1}, {PB_12, 12}, {PB_13, 13}, {PB_15, 15}};
+
+    //Records the watchdog running out if it has not been kicked in time
+    void watchdogCheck() {
+        Sim &s = sim();
+        if (s.watchdogTimeout == 0 || s.watchdogExpired != 0) return;
+        uint64_t deadline = s.watchdogKicked + s.watchdogTimeout * 1000ULL;
+        if (s.now > deadline) s.watchdogExpired = deadline;
+    }
+}
+
+int host_printf(const char *format, ...) {
+    if (host::console == nullptr) return 0;
+    va_list args;
+    va_start(args, format);
+    int n = vfprintf(host::console, format, args);
+    va_end(args);
+    return n;
+}
+
+uint64_t host::now() {
+    return sim().now;
+}
+
+int host::schedule(uint64_t at, std::function<void()> fn, uint64_t period) {
+    Sim &s = sim();
+    int id = s.nextId++;
+    s.entries[id] = Entry{fn, period};
+    s.slots.push(Slot{at, s.seq++, id});
+    return id;
+}
+
+bool host::cancel(int id) {
+    return sim().entries.erase(id) > 0;
+}
+
+void host::run() {
+    Sim &s = sim();
+    while (!s.slots.empty() && s.slots.top().time <= s.stop) {
+        Slot slot = s.slots.top();
+        s.slots.pop();
+        auto it = s.entries.find(slot.id);
+        if (it == s.entries.end()) continue;    //cancelled
+        s.now = slot.time;
+        watchdogCheck();
+        std::function<void()> fn = it->second.fn;
+        uint64_t period = it->second.period;
+        if (period == 0) s.entries.erase(it);   //a one-shot timer may be attached again from its own callback
+        fn();
+        if (period != 0 && s.entries.count(slot.id)) s.slots.push(Slot{slot.time + period, s.seq++, slot.id});
+    }
+    s.now = s.stop;
+    watchdogCheck();
+}
+
+int host::pinRead(PinName pin) {
+    return sim().levels[pin];
+}
+
+void host::pinWrite(PinName pin, int level) {
+    Sim &s = sim();
+    if (s.levels[pin] == level) return;
+    s.levels[pin] = level;
+    s.edges.push_back(Edge{s.now, pin, level});
+}
+
+void host::onRise(PinName pin, std::function<void()> fn) {
+    sim().rises[pin].push_back(fn);
+}
+
+void host::portWrite(char port, uint32_t value) {
+    if (port != 'B') return;
+    for (auto &p : portBPins) pinWrite(p.pin, (value >> p.bit) & 1);
+}
+
+void host::watchdogStart(uint32_t ms) {
+    sim().watchdogTimeout = ms;
+    sim().watchdogKicked = sim().now;
+}
+
+void host::watchdogKick() {
+    watchdogCheck();
+    sim().watchdogKicked = sim().now;
+}
+
+void host::setPin(PinName pin, uint64_t at, int level, int bounces) {
+    //chatter ends at the final level, so an odd position in the sequence is the other level
+    for (int i = bounces; i >= 0; i--) {
+        int l = i % 2 == 0 ? level : !level;
+        schedule(at + (bounces - i) * 100, [pin, l] {
+            Sim &s = sim();
+            int was = s.levels[pin];
+            s.levels[pin] = l;
+            if (!was && l) for (auto &fn : s.rises[pin]) fn();  //a rising edge interrupt
+        });
+    }
+}
+
+void host::press(PinName pin, uint64_t at, uint64_t hold, int bounces) {
+    setPin(pin, at, 1, bounces);
+    setPin(pin, at + hold, 0, bounces);
+}
+
+void host::at(uint64_t time, std::function<void()> fn) {
+    schedule(time, fn);
+}
+
+int device_main();
+
+void host::start(uint64_t stop) {
+    sim().stop = stop;
+    device_main();
+}
+
+const std::vector<host::Edge> &host::edges() {
+    return sim().edges;
+}
+
+uint64_t host::watchdogExpired() {
+    return sim().watchdogExpired;
+}
@@ -0,0 +1,52 @@
+#ifndef HOST_H_
+#define HOST_H_
+
+#include "mbed.h"
+#include <vector>
+
+#undef printf
+
+/* ******************************************************************
+ Scripting and capture for the host build of the firmware.
+
+   A scenario schedules its input before it starts the firmware: pin
+   levels at given times, optionally with contact bounce, and the time
+   the run stops. host::start() then runs the firmware's main(), whose
+   event queue dispatch drives the whole schedule and returns at the
+   stop time. Afterwards every output change is in host::edges(), in
+   order, with its time. The firmware's globals live for the whole
+   process, so each scenario runs in its own process.
+**********************************************************************/
+
+namespace host {
+    //An output pin changing level
+    struct Edge {
+        uint64_t time;      //microseconds
+        PinName pin;
+        int level;
+    };
+
+    //Sets an input pin to a level at a time. With bounces, the contact chatters that many
+    //times, 100us apart, before it settles at the level.
+    void setPin(PinName pin, uint64_t at, int level, int bounces = 0);
+
+    //Presses a button at a time and releases it hold microseconds later, bouncing on both edges
+    void press(PinName pin, uint64_t at, uint64_t hold, int bounces = 0);
+
+    //Calls fn at a time, for a scenario to look at or change firmware state mid-run
+    void at(uint64_t time, std::function<void()> fn);
+
+    //Runs the firmware's main() until the given time
+    void start(uint64_t stop);
+
+    //Output changes captured so far
+    const std::vector<Edge> &edges();
+
+    //Time the watchdog ran out, or 0 if it never did
+    uint64_t watchdogExpired();
+
+    //Where the firmware's printf goes; nullptr (the default) drops it
+    extern FILE *console;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef HOST_MBED_H_
+#define HOST_MBED_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+/* ******************************************************************
+ Host stand-in for the parts of mbed OS that main.cpp uses.
+
+   Everything runs on one Linux thread in simulated time. Timers, the
+   event queue and scripted pin changes are all entries in one schedule
+   (host.h), taken in time order; interrupts and queued events are both
+   just callbacks, so nothing is ever preempted and critical sections
+   are empty. Outputs written through DigitalOut or GPIOB->ODR are
+   captured with their simulated time for the benchmarks to check.
+
+   The classes cover only the members main.cpp calls, with the same
+   signatures, so the firmware builds unchanged. printf from the firmware
+   goes to host_console, which is off unless a benchmark turns it on.
+**********************************************************************/
+
+using namespace std::chrono_literals;
+
+#define EVENTS_EVENT_SIZE 64
+
+//Pins used by the board, plus PB_1 for the LED, which main.cpp drives through GPIOB->ODR
+enum PinName { PB_1, PB_12, PB_13, PB_15, PC_6, PC_8, PC_9, PC_10, PC_11, PC_12, PD_0, PE_14, PF_8, PIN_COUNT, NC };
+enum PinMode { PullNone, PullUp, PullDown };
+
+namespace host {
+    uint64_t now();         //simulated time in microseconds
+    int schedule(uint64_t at, std::function<void()> fn, uint64_t period = 0);  //adds a callback; returns its ID
+    bool cancel(int id);    //removes a callback that has not run, or stops a periodic one
+    void run();             //takes callbacks in time order until the stop time
+    int pinRead(PinName pin);
+    void pinWrite(PinName pin, int level);  //drives an output and captures the change
+    void onRise(PinName pin, std::function<void()> fn);
+    void portWrite(char port, uint32_t value);  //drives the pins of a GPIO port from its ODR
+    void watchdogStart(uint32_t ms);
+    void watchdogKick();
+}
+
+int host_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+#define printf host_printf
+
+//A peripheral register; ODR writes are passed on to the pins
+struct Register {
+    uint32_t value = 0;
+    char port = 0;  //GPIO port whose pins follow this register, or 0
+    Register &operator=(uint32_t v) { value = v; if (port) host::portWrite(port, value); return *this; }
+    Register &operator|=(uint32_t v) { return *this = value | v; }
+    Register &operator&=(uint32_t v) { return *this = value & v; }
+    operator uint32_t() const { return value; }
+};
+
+struct GPIO_TypeDef { Register MODER, ODR, IDR; };
+struct RCC_TypeDef { Register AHB2ENR; };
+extern GPIO_TypeDef *GPIOB;
+extern RCC_TypeDef *RCC;
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin, int value = 0) : _pin(pin) { write(value); }
+    void write(int value) { host::pinWrite(_pin, value != 0); }
+    int read() { return host::pinRead(_pin); }
+    DigitalOut &operator=(int value) { write(value); return *this; }
+    operator int() { return read(); }
+private:
+    PinName _pin;
+};
+
+class InterruptIn {
+public:
+    InterruptIn(PinName pin, PinMode mode = PullNone) : _pin(pin) { (void) mode; }
+    int read() { return host::pinRead(_pin); }
+    operator int() { return read(); }
+    void mode(PinMode) {}
+    void rise(std::function<void()> fn) { host::onRise(_pin, fn); }
+private:
+    PinName _pin;
+};
+
+class BusIn {
+public:
+    template <typename... Pins>
+    BusIn(Pins... pins) : _pins{pins...}, _count(sizeof...(pins)) {}
+    int read() {
+        int value = 0;
+        for (int i = 0; i < _count; i++) value |= host::pinRead(_pins[i]) << i;  //first pin is bit 0
+        return value;
+    }
+    operator int() { return read(); }
+    void mode(PinMode) {}
+private:
+    PinName _pins[16];
+    int _count;
+};
+
+class Ticker {
+public:
+    ~Ticker() { detach(); }
+    void attach(std::function<void()> fn, std::chrono::microseconds period) {
+        detach();
+        _id = host::schedule(host::now() + period.count(), fn, period.count());
+    }
+    void detach() { if (_id) host::cancel(_id); _id = 0; }
+private:
+    int _id = 0;
+};
+
+class Timeout {
+public:
+    ~Timeout() { detach(); }
+    void attach(std::function<void()> fn, std::chrono::microseconds delay) {
+        detach();
+        _id = host::schedule(host::now() + delay.count(), fn);
+    }
+    void detach() { if (_id) host::cancel(_id); _id = 0; }
+private:
+    int _id = 0;
+};
+
+class LowPowerTicker : public Ticker {};
+class LowPowerTimeout : public Timeout {};
+
+class EventQueue {
+public:
+    EventQueue(unsigned size = 0) { (void) size; }
+    template <typename F, typename... Args>
+    int call(F f, Args... args) { return host::schedule(host::now(), std::bind(f, args...)); }
+    template <typename Rep, typename Period, typename F, typename... Args>
+    int call_in(std::chrono::duration<Rep, Period> delay, F f, Args... args) {
+        return host::schedule(host::now() + micros(delay), std::bind(f, args...));
+    }
+    template <typename Rep, typename Period, typename F, typename... Args>
+    int call_every(std::chrono::duration<Rep, Period> period, F f, Args... args) {
+        uint64_t us = micros(period);
+        return host::schedule(host::now() + us, std::bind(f, args...), us);
+    }
+    bool cancel(int id) { return host::cancel(id); }
+    void dispatch_forever() { host::run(); }
+private:
+    template <typename Duration>
+    static uint64_t micros(Duration d) { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); }
+};
+
+class Watchdog {
+public:
+    static Watchdog &get_instance() { static Watchdog watchdog; return watchdog; }
+    bool start(uint32_t ms) { host::watchdogStart(ms); return true; }
+    void kick() { host::watchdogKick(); }
+};
+
+struct Kernel {
+    struct Clock {
+        using duration = std::chrono::milliseconds;
+        using rep = duration::rep;
+        using period = duration::period;
+        using time_point = std::chrono::time_point<Clock>;
+        static const bool is_steady = true;
+        static time_point now() { return time_point(duration(host::now() / 1000)); }
+    };
+};
+
+class CriticalSectionLock {
+public:
+    CriticalSectionLock() {}    //nothing preempts anything on the host
+};
+
+inline uint32_t us_ticker_read() { return (uint32_t) host::now(); }
+
+#endif
@@ -9,20 +9,11 @@
     as morse code through a vibration motor.
 */
 #include "mbed.h"
+#include <atomic>
 
-Mutex msglock;      //protexts msg and len variables
-Mutex inputlock;    //used to protect input variable
-Mutex enterlock;    //used to protect enter ISR from bounce
-Mutex backspacelock;//used to protect backspace ISR from bounce
-Mutex sendlock;     //used to protect send ISR from bounce
-
-ConditionVariable enterCond(enterlock);         //used to protect enter ISR from bounce
-ConditionVariable backspaceCond(backspacelock); //used to protect backspace ISR from bounce
-ConditionVariable sendCond(sendlock);           //used to protect send ISR from bounce
-
-InterruptIn enterButton(PB_15, PullDown);       //button used for enter ISR
-InterruptIn backspaceButton(PB_13, PullDown);   //button used for backspace ISR
-InterruptIn sendButton(PB_12, PullDown);        //button used for send ISR
+InterruptIn enterButton(PB_15, PullDown);       //enter button; wakes the debouncer, which samples it
+InterruptIn backspaceButton(PB_13, PullDown);   //backspace button; wakes the debouncer, which samples it
+InterruptIn sendButton(PB_12, PullDown);        //send button; wakes the debouncer, which samples it
 
 BusIn bumps(PC_12, PC_11, PC_10, PC_9, PC_8, PC_6); //input bus for bump buttons.
 //From highest to lowest bit: bottom right, middle right,  top right, bottom left, middle left, top left.
@@ -32,32 +23,292 @@ DigitalOut vcc(PD_0);   //output always on for button input
 DigitalOut braillevibrate(PE_14);   //vibration motor used for braille keyboard UI
 DigitalOut morsevibrate(PF_8);      //vibration motor used for morse code output
 
-Thread isrThread(osPriorityHigh);           //thread that handles the ISR Event Queue
-Thread enterThread(osPriorityNormal);       //thread that handles the enter button's functionality
-Thread backspaceThread(osPriorityNormal);   //thread that handles the backspace button's functionality
-Thread sendThread(osPriorityNormal);        //thread that handles the send button's functionality
+EventQueue queue(64*EVENTS_EVENT_SIZE);     //Event Queue dispatched by main; runs every input event
+
+LowPowerTimeout morseTimer; //low power timer that steps the morse player from one on/off edge to the next
+Ticker debounceTicker;  //samples every button at 1kHz for the debouncer; only attached while a button is down
+
+#define MSG_MAX 140     //maximum length of the message in characters
 
-EventQueue queue(64*EVENTS_EVENT_SIZE);     //Event Queue used by the ISRs
+#ifndef DEBOUNCE_SETTLE          //can be set in mbed_app.json
+#define DEBOUNCE_SETTLE 10   //default milliseconds a button must read the same before it counts as pressed or released
+#endif
+#define DEBOUNCE_PINS 9     //the 6 bumps in bits 0-5, then enter, backspace and send
+#define STATS_CHORD 0b111111    //bumps held with send to print RAM use, keypress latency and power use instead
+#define WATCHDOG_TIMEOUT 8000   //milliseconds without a kick before the watchdog restarts the system
+#define HEALTH_PERIOD 4s    //how often health is checked and, if it is good, the watchdog kicked
+#define HEALTH_SLACK 100    //milliseconds a context may run late before it counts as stalled
 
-char msg[140] = {};     //holds a string of up to 140 characters, written by inputs, read by output
+//Estimated supply current of each power state, in microamps, for the power report
+#define CURRENT_DEEP_SLEEP 3    //MCU in stop 2 with RAM kept, waiting for a button or a low power timer
+#define CURRENT_AWAKE 4000      //MCU kept out of deep sleep by the 1kHz debouncer
+#define CURRENT_MOTOR 80000     //one vibration motor on
+#define CURRENT_LED 1300        //morse LED through its 1kΩ resistor
+
+//Everything below that is not marked otherwise is only used from the event queue, so needs no locks.
+char msg[MSG_MAX + 1] = {}; //holds a string of up to 140 characters, written by inputs, read by output
 int len = 0;            //keeps track of the length of the message stored in msg
 int input = 0;          //used to read the bump button bus; 6-bit integer
+bool grade2 = false;    //Grade 2 contractions are enabled
+int wordcells = 0;      //cells entered in the current word, -1 if unknown
+int lastcell = 0;       //last cell entered in letter mode
+int lastlen = 0;        //characters the last cell added to msg
+bool symbol = false;    //⠸ was entered and is waiting for the second cell of its symbol
+
+//events that drive the input state machine, posted by the debouncer
+enum InputEvent {
+    EV_ENTER,       //enter button pressed; the bumps held at that moment are the chord
+    EV_BACKSPACE,   //backspace button pressed
+    EV_SEND,        //send button pressed
+    EV_RELEASE,     //enter, backspace or send released
+};
+
+int feedbackEdges = 0;                  //keyboard motor edges left in the feedback pattern
+std::chrono::milliseconds feedbackLength(0);    //length of each feedback pulse
+int feedbackId = 0;                     //queue ID of the next feedback step, 0 if none is pending
+
+//Contexts that must keep running for the system to be healthy. Each active context sets the time
+//it is due to run next; the health check only kicks the watchdog if none of them is overdue.
+enum Context {
+    CTX_DEBOUNCE,   //debounceTicker interrupt, while a button is down
+    CTX_MORSE,      //morseTimer interrupt, while a message is playing
+    CONTEXTS
+};
+
+const char *contextNames[CONTEXTS] = {"debouncer", "morse player"};   //names for the console
+volatile uint32_t contextDue[CONTEXTS] = {};    //millisecond time each context must run by, 0 while it is idle
+bool healthy = true;        //every context was on time at the last health check; only used from the event queue
+
+//Loads that decide the power state. The MCU is in deep sleep whenever LOAD_AWAKE is off.
+enum Load {
+    LOAD_AWAKE,     //debouncer running
+    LOAD_BRAILLE,   //keyboard vibration motor on
+    LOAD_MORSE,     //morse vibration motor and LED on
+    LOADS
+};
+
+bool loadOn[LOADS] = {};        //load is on; changed with interrupts disabled
+uint32_t loadSince[LOADS] = {}; //millisecond time a load that is on was turned on
+uint64_t loadTime[LOADS] = {};  //milliseconds each load has been on, not counting the current stretch
+
+//Sources of wakeups; each counts an interrupt or timer that could have woken the MCU
+enum Wake {
+    WAKE_BUTTON,    //enter, backspace or send edge starting the debouncer
+    WAKE_DEBOUNCE,  //debouncer sample
+    WAKE_MORSE,     //morse player step
+    WAKE_FEEDBACK,  //keyboard motor feedback step
+    WAKE_HEALTH,    //health check
+    WAKES
+};
+
+volatile uint32_t wakes[WAKES] = {};    //wakeups from each source since startup
+
+//Debouncer state. Each pin has an integrator that counts up for every sample it reads pressed and
+//down for every sample it reads released, between 0 and debounceSettle; the pin only changes state
+//when its integrator reaches an end, so bounce shorter than the settle time never gets through.
+//Only the debounceTicker interrupt writes these. The ticker keeps the MCU out of deep sleep, so it is
+//started by a button edge and stops itself once every pin has settled released.
+uint8_t debounceCount[DEBOUNCE_PINS] = {};  //integrator of each pin
+uint16_t debounceState = 0;                 //debounced state of each pin, one bit each
+volatile int debounceSettle = 1;            //samples, at 1 per millisecond, to settle; set by debounceSettleTime
+volatile bool debounceRunning = false;      //debounceTicker is attached
+volatile uint32_t buttonEdge[3] = {};   //microsecond time of the first raw rising edge of enter, backspace and send
+                                        //in the press being debounced, 0 if none; set by debounceWake
+uint32_t latencyLast = 0;   //microseconds from the last press's first raw edge to its event being handled,
+                            //including the debounce settle time
+uint32_t latencyMax = 0;    //longest of those since startup
+
+//A braille cell is a 6-bit number, one bit per bump, from highest to lowest bit:
+//top left, middle left, bottom left, top right, middle right, bottom right.
+//Those are braille dots 1 to 6, so dot n is bit 6 - n.
+
+//cell(): converts a string of braille dot numbers (i.e. "1245") to its 6-bit cell
+constexpr int cell(const char *dots) {
+    int bits = 0;
+    for (; *dots != '\0'; dots++) bits |= 1 << (6 - (*dots - '0'));   //set the bit for each dot
+    return bits;
+}
+
+template <typename Value> struct CellDef { const char *dots; Value value; };   //one table entry: dots and what they decode to
+template <typename Value> struct CellTable { Value entry[64]; };                //decodes each of the 64 cells; 0 if the cell is invalid
+
+//makeTable(): builds a 64-entry lookup table from a list of definitions at compile time
+template <typename Value, size_t N>
+constexpr CellTable<Value> makeTable(const CellDef<Value> (&defs)[N]) {
+    CellTable<Value> table = {};
+    for (size_t i = 0; i < N; i++) table.entry[cell(defs[i].dots)] = defs[i].value;
+    return table;
+}
+
+//distinctCells(): checks at compile time that no cell is defined twice in a list
+template <typename Value, size_t N>
+constexpr bool distinctCells(const CellDef<Value> (&defs)[N]) {
+    for (size_t i = 0; i < N; i++)
+        for (size_t j = i + 1; j < N; j++)
+            if (cell(defs[i].dots) == cell(defs[j].dots)) return false;
+    return true;
+}
+
+constexpr int NUMBER_SIGN = cell("3456");   //⠼ switches to numbers
+constexpr int MODE_SIGN = cell("56");       //⠰ switches back to letters, or toggles Grade 2 in letter mode
+constexpr int SYMBOL_SIGN = cell("456");    //⠸ starts a two-cell symbol
+constexpr int SLASH = cell("34");           //⠌ after ⠸ is a slash; on its own it is the letters "st"
+
+//letter mode: Grade 1 letters and punctuation
+constexpr CellDef<char> letterDefs[] = {
+    {"", ' '},                                                                                      //blank = space
+    {"1", 'a'}, {"12", 'b'}, {"14", 'c'}, {"145", 'd'}, {"15", 'e'}, {"124", 'f'}, {"1245", 'g'},  //⠁ ⠃ ⠉ ⠙ ⠑ ⠋ ⠛
+    {"125", 'h'}, {"24", 'i'}, {"245", 'j'}, {"13", 'k'}, {"123", 'l'}, {"134", 'm'}, {"1345", 'n'},//⠓ ⠊ ⠚ ⠅ ⠇ ⠍ ⠝
+    {"135", 'o'}, {"1234", 'p'}, {"12345", 'q'}, {"1235", 'r'}, {"234", 's'}, {"2345", 't'},       //⠕ ⠏ ⠟ ⠗ ⠎ ⠞
+    {"136", 'u'}, {"1236", 'v'}, {"2456", 'w'}, {"1346", 'x'}, {"13456", 'y'}, {"1356", 'z'},      //⠥ ⠧ ⠺ ⠭ ⠽ ⠵
+    {"2", ','}, {"23", ';'}, {"25", ':'}, {"256", '.'}, {"235", '!'}, {"236", '?'},               //⠂ ⠆ ⠒ ⠲ ⠖ ⠦
+    {"3", '\''}, {"36", '-'}, {"356", '"'}, {"2356", '('},                                         //⠄ ⠤ ⠴ ⠶
+};
+
+//number mode: digits, with the decimal point and comma
+constexpr CellDef<char> numberDefs[] = {
+    {"", ' '},                                                                                      //blank = space
+    {"1", '1'}, {"12", '2'}, {"14", '3'}, {"145", '4'}, {"15", '5'},                                //⠁ ⠃ ⠉ ⠙ ⠑
+    {"124", '6'}, {"1245", '7'}, {"125", '8'}, {"24", '9'}, {"245", '0'},                           //⠋ ⠛ ⠓ ⠊ ⠚
+    {"256", '.'}, {"2", ','},                                                                       //⠲ ⠂
+};
+
+//Grade 2: strong and part-word contractions, used anywhere in a word in place of the letter table
+constexpr CellDef<const char *> contractionDefs[] = {
+    {"12346", "and"}, {"123456", "for"}, {"12356", "of"}, {"2346", "the"}, {"23456", "with"},      //⠯ ⠿ ⠷ ⠮ ⠾
+    {"16", "ch"}, {"126", "gh"}, {"146", "sh"}, {"1456", "th"}, {"156", "wh"}, {"1246", "ed"},     //⠡ ⠣ ⠩ ⠹ ⠱ ⠫
+    {"12456", "er"}, {"1256", "ou"}, {"246", "ow"}, {"34", "st"}, {"345", "ar"}, {"346", "ing"},   //⠻ ⠳ ⠪ ⠌ ⠜ ⠬
+};
+
+//Grade 2: wordsigns, used when a cell stands alone as a whole word
+constexpr CellDef<const char *> wordsignDefs[] = {
+    {"12", "but"}, {"14", "can"}, {"145", "do"}, {"15", "every"}, {"124", "from"}, {"1245", "go"},  //⠃ ⠉ ⠙ ⠑ ⠋ ⠛
+    {"125", "have"}, {"245", "just"}, {"13", "knowledge"}, {"123", "like"}, {"134", "more"},        //⠓ ⠚ ⠅ ⠇ ⠍
+    {"1345", "not"}, {"1234", "people"}, {"12345", "quite"}, {"1235", "rather"}, {"234", "so"},    //⠝ ⠏ ⠟ ⠗ ⠎
+    {"2345", "that"}, {"136", "us"}, {"1236", "very"}, {"2456", "will"}, {"1346", "it"},           //⠞ ⠥ ⠧ ⠺ ⠭
+    {"13456", "you"}, {"1356", "as"},                                                               //⠽ ⠵
+    {"16", "child"}, {"146", "shall"}, {"1456", "this"}, {"156", "which"}, {"1256", "out"}, {"34", "still"}, //⠡ ⠩ ⠹ ⠱ ⠳ ⠌
+};
+
+static_assert(cell("1") == 0b100000 && cell("6") == 0b000001, "dot 1 is the highest bit, dot 6 the lowest");
+static_assert(distinctCells(letterDefs) && distinctCells(numberDefs), "a cell is defined twice");
+static_assert(distinctCells(contractionDefs) && distinctCells(wordsignDefs), "a cell is defined twice");
+
+constexpr CellTable<char> letterTable = makeTable(letterDefs);                      //letter mode lookup
+constexpr CellTable<char> numberTable = makeTable(numberDefs);                      //number mode lookup
+constexpr CellTable<const char *> contractionTable = makeTable(contractionDefs);    //Grade 2 lookup inside a word
+constexpr CellTable<const char *> wordsignTable = makeTable(wordsignDefs);          //Grade 2 lookup for a word of one cell
+
+//result of adding a cell to msg, which decides the feedback the user feels
+enum CellResult {
+    CELL_OK,        //text was added or removed
+    CELL_INVALID,   //the cell means nothing in the current mode
+    CELL_FULL,      //the text does not fit in msg
+    CELL_MODE,      //Grade 2 was turned on or off
+};
+
+#ifndef MORSE_WPM               //both speeds can be set in mbed_app.json
+#define MORSE_WPM 12            //default character speed in words per minute; 12 WPM is a 100ms unit
+#endif
+#ifndef MORSE_FARNSWORTH_WPM
+#define MORSE_FARNSWORTH_WPM 12 //default overall speed; below MORSE_WPM, only the gaps are stretched
+#endif
+
+//A character's morse code packed as its on/off sequence: count elements, each on for 1 unit
+//(a dot) or 3 units (a dash, its bit set in dashes, first element in bit 0) and off for 1 unit after.
+struct MorseCode { uint8_t count; uint8_t dashes; };
+struct MorseDef { char ch; const char *code; };     //one table entry: a character and its code as dots and dashes
+struct MorseTable { MorseCode entry[128]; };        //code for each ASCII character; count is 0 if it has none
 
-void enter();           //function that the enter thread runs
-void backspace();       //function that the backspace thread runs
-void send();            //function that the send thread runs
+//morse(): packs a code written as dots and dashes (i.e. "-.-.") at compile time
+constexpr MorseCode morse(const char *code) {
+    MorseCode packed = {0, 0};
+    for (; *code != '\0'; code++, packed.count++)
+        if (*code == '-') packed.dashes |= 1 << packed.count;  //set the bit for each dash
+    return packed;
+}
+
+//makeMorseTable(): builds the 128-entry code table from a list of definitions at compile time
+template <size_t N>
+constexpr MorseTable makeMorseTable(const MorseDef (&defs)[N]) {
+    MorseTable table = {};
+    for (size_t i = 0; i < N; i++) table.entry[(int) defs[i].ch] = morse(defs[i].code);
+    return table;
+}
+
+constexpr MorseDef morseDefs[] = {
+    {'a', ".-"}, {'b', "-..."}, {'c', "-.-."}, {'d', "-.."}, {'e', "."}, {'f', "..-."}, {'g', "--."},
+    {'h', "...."}, {'i', ".."}, {'j', ".---"}, {'k', "-.-"}, {'l', ".-.."}, {'m', "--"}, {'n', "-."},
+    {'o', "---"}, {'p', ".--."}, {'q', "--.-"}, {'r', ".-."}, {'s', "..."}, {'t', "-"}, {'u', "..-"},
+    {'v', "...-"}, {'w', ".--"}, {'x', "-..-"}, {'y', "-.--"}, {'z', "--.."},
+    {'0', "-----"}, {'1', ".----"}, {'2', "..---"}, {'3', "...--"}, {'4', "....-"},
+    {'5', "....."}, {'6', "-...."}, {'7', "--..."}, {'8', "---.."}, {'9', "----."},
+    {'.', ".-.-.-"}, {',', "--..--"}, {'?', "..--.."}, {'\'', ".----."}, {'!', "-.-.--"}, {'/', "-..-."},
+    {'(', "-.--."}, {')', "-.--.-"}, {':', "---..."}, {';', "-.-.-."}, {'-', "-....-"}, {'"', ".-..-."},
+};
+
+static_assert(morse("-.-.").count == 4 && morse("-.-.").dashes == 0b0101, "first element is bit 0");
+
+constexpr MorseTable morseTable = makeMorseTable(morseDefs);   //morse code lookup; space and '#' have no code
+
+#define OUTBOX_SIZE 8    //messages that can wait to be played, including the one playing; a power of two
+
+//Outbox of sent messages, a lock-free ring with one producer (send, on the event queue) and one consumer
+//(the morse player, in morseTimer's interrupt).
+//The producer writes a slot and then publishes it by advancing outboxHead; the consumer plays the
+//message in place and frees the slot by advancing outboxTail once it is done with it.
+char outbox[OUTBOX_SIZE][MSG_MAX + 1] = {};     //message slots
+std::atomic<unsigned> outboxHead(0);            //count of messages ever queued; written by the producer only
+std::atomic<unsigned> outboxTail(0);            //count of messages ever played; written by the consumer only
 
-void enterISR();        //ISR called when enter button is pressed
-void backspaceISR();    //ISR called when backspace button is pressed
-void sendISR();         //ISR called when send button is pressed
+//State of the morse player. Only the morseTimer callback changes it while morseBusy is set;
+//the event queue starts it when it is idle and changes it with interrupts disabled.
+const char *morseText = nullptr;    //message being played, in its outbox slot
+volatile bool morseBusy = false;    //a message is being played
+int morsePos = 0;           //index in morseText of the character being played
+int morseElement = 0;       //element of that character being played
+bool morseOn = false;       //output is on
+uint32_t morseUnit = 0;         //length of a dot and of the gap between elements, in microseconds
+uint32_t morseLetterGap = 0;    //gap between characters, in microseconds
+uint32_t morseWordGap = 0;      //gap between words, in microseconds
+
+void inputEvent(InputEvent ev, int chord);  //runs the input state machine for one event
+void buttonEvent(InputEvent ev, int chord, uint32_t edge);  //records how long a button event waited, then runs it
+void backspace();       //deletes the most recently added character from msg
+
+void debounceSample();  //called by debounceTicker; samples every pin and posts press and release events
+void debounceSettleTime(int ms);    //sets how long a pin must read the same to change state
+void debounceWake();    //ISR called on a button edge; starts the debouncer if it is stopped
+uint32_t nowMs();       //milliseconds since startup, kept through deep sleep
+void checkIn(Context ctx, uint32_t delay);  //records that a context will run again within delay milliseconds
+void powerLoad(Load load, bool on);     //records a load being turned on or off
 
 void brailleToText();   //reads the input variable, and writes the appropriate character to the msg string
-void dot();             //outputs a morse code "dot" to the morse vibration motor
-void dash();            //outputs a morse code "dash" to the morse vibration motor
-void printMorse();      //reads msg string and outputs it as morse code to the vibration motor
+CellResult appendCell(int c);   //decodes one cell and adds its text to msg
+bool expandWordsign(int after);     //replaces a lone Grade 2 cell ending msg with its wordsign, if it fits
+bool appendText(const char *text, int from);    //writes text into msg at position from, if it fits
+void cellFeedback(CellResult result);   //vibrates the keyboard motor to tell the user what a cell did
+void feedbackStep();    //turns the keyboard motor on or off for the next part of the feedback pattern
+void healthCheck();     //kicks the watchdog if every context is on time; called periodically from the event queue
+void printStats();      //prints RAM use, keypress latency and power use on the console
+void morseSchedule(uint32_t us);    //sets morseTimer to take the next morse step
+void printMorse();      //queues msg in the outbox for the morse player
+bool outboxPush(const char *text, int n);   //copies a message into the outbox; producer side
+const char *outboxFront();  //oldest message in the outbox, or nullptr; consumer side
+void outboxPop();       //frees the oldest message in the outbox; consumer side
+void morseSpeed(int wpm, int farnsworth);   //sets the morse timing from the character and overall speeds
+void morseStep();       //called by morseTimer at each on/off edge of the morse output
+void morseNext(int from, uint32_t gap);     //schedules the next character with a code, or finishes the message
+void morseBegin(uint32_t gap);  //starts playing the oldest message in the outbox, if there is one
+void morseFinish();     //frees the message that was playing and moves on to the next
+void morseKick();       //starts the morse player if it is idle
+void morseOutput(int on);   //turns the morse motor and LED on or off
+void morseSkip();       //skips the rest of the word being played
+void morseAbort();      //stops playing the message
 
-//main(): initializes and starts threads and ISRs,
-//Initializes watchdog, periodically kicks the watchdog.
+//main(): initializes the outputs, watchdog and button interrupts, then runs the event queue forever.
+//Every input event is handled on main's thread; morse output runs from morseTimer. Between events,
+//with no button down, nothing keeps the MCU out of deep sleep.
 int main() {
     vcc = 1;    //enable vcc to always be high
 
@@ -68,263 +319,488 @@ int main() {
 
     bumps.mode(PullDown);   //set bump bus to pull down
 
+    morseSpeed(MORSE_WPM, MORSE_FARNSWORTH_WPM);    //set morse timing
+    debounceSettleTime(DEBOUNCE_SETTLE);    //set the integrators' threshold, within what they can count to
+
     Watchdog &watchdog = Watchdog::get_instance();  //initialize watchdog
 
-    watchdog.start(8000);   //start the watchdog. If the watchdot is not kicked for 8 seconds, system is restarted.
+    watchdog.start(WATCHDOG_TIMEOUT);   //start the watchdog. If the watchdot is not kicked for 8 seconds, system is restarted.
 
-    enterButton.rise(queue.event(&enterISR));           //set enter button as interrupt
-    backspaceButton.rise(queue.event(&backspaceISR));   //set backspace button as interrupt
-    sendButton.rise(queue.event(&sendISR));             //set send button as interrupt
+    enterButton.rise(&debounceWake);        //wake the debouncer when a button is pressed
+    backspaceButton.rise(&debounceWake);
+    sendButton.rise(&debounceWake);
 
-    enterThread.start(enter);           //start thread for enter button functionality
-    backspaceThread.start(backspace);   //start thread for backspace button functionality
-    sendThread.start(send);             //start thread for send button functionality
+    queue.call_every(HEALTH_PERIOD, &healthCheck);  //kick watchdog while healthy; half the watchdog's timeout
 
-    isrThread.start(callback(&queue, &EventQueue::dispatch_forever));   //set ISR thread to handle the event queue
-    
-    //Loop forever
-    while(1){
-        watchdog.kick();            //kick watchdog
-        ThisThread::sleep_for(1s);  //sleep for 1 second; 1/8 of the watchdog's timeout
-    }
+    queue.dispatch_forever();   //handle events forever
     return 0;
 }
 
-//enter(): run forever by enterThread. When it receives a signal by the enterISR,
-//it will write the bump bus' current state to input and call brailleToText()
-void enter() {
-    //loop forever
-    while (1) {
-        enterlock.lock();       //lock enter mutex to protect from bounce   
-        enterCond.wait();       //wait for a signal from ISR
-        inputlock.lock();       //lock input mutex
-        ThisThread::sleep_for(150ms);   //sleep for 150 milliseconds to account for bounce on the bump buttons
-        input = bumps.read();   //write current state of bump buttons to input
-        inputlock.unlock();     //unlock input mutex
-        brailleToText();        //call function that converts input to character and adds it to msg
-        printf("message: \"%s\"\n", msg);   //print current message on the console
-        enterlock.unlock();     //unlock enter mutex
+//inputEvent(): the input state machine. Runs on the event queue, so it must never sleep;
+//anything that takes time, like a feedback pulse, is finished by a later event.
+//Presses come from the debouncer already clean, so none are ignored.
+void inputEvent(InputEvent ev, int chord) {
+    switch (ev) {
+        case EV_ENTER:
+            input = chord;          //the bumps latched when enter was pressed
+            brailleToText();        //call function that converts input to character and adds it to msg
+            printf("message: \"%s\"\n", msg);   //print current message on the console
+            break;
+        case EV_BACKSPACE:
+            backspace();
+            printf("message: \"%s\"\n", msg);   //print current message on the console
+            cellFeedback(CELL_OK);  //notify user it received the input
+            break;
+        case EV_SEND:
+            if (chord == STATS_CHORD) printStats();     //on demand only, so the board stays in deep sleep
+            else printMorse();  //call function to output the message as morse code
+            break;
+        case EV_RELEASE:
+            break;          //nothing happens on release
     }
 }
 
-//backspace(): run forever by backspaceThread. When it receives a signal by the backspaceISR,
-//it will delete the most recently added character from the msg string.
+//buttonEvent(): runs a button's event, first recording how long it took from the button's raw edge
+void buttonEvent(InputEvent ev, int chord, uint32_t edge) {
+    if (ev != EV_RELEASE) {
+        latencyLast = us_ticker_read() - edge;
+        if (latencyLast > latencyMax) latencyMax = latencyLast;
+    }
+    inputEvent(ev, chord);
+}
+
+//backspace(): deletes the most recently added character from the msg string,
+//or with nothing to delete, stops the message being played.
 void backspace() {
-    //loop forever
-    while (1) {
-        backspacelock.lock();   //lock backspace mutex to protect from bounce
-        backspaceCond.wait();   //wait for a signal from the ISR
-        msglock.lock();         //lock msg mutex
-        if (len > 0) {          //if msg is not empty:
-            len--;              //reduce the length of msg by 1
-            msg[len] = '\0';    //set erased character to ASCII null
-        }
-        printf("message: \"%s\"\n", msg); //print current message on the console   
-        msglock.unlock();               //unlock msg mutex
-        braillevibrate = 1;             //enable keyboard motor to notify user it received the input
-        ThisThread::sleep_for(100ms);   //sleep for 100ms
-        braillevibrate = 0;             //disable keyboard motor
-        ThisThread::sleep_for(100ms);   //sleep for another 100ms to prevent bounce
-        backspacelock.unlock();         //unlock backspace mutex
+    if (symbol) symbol = false;     //drop a ⠸ still waiting for its second cell
+    else if (len > 0) {     //if msg is not empty:
+        len--;              //reduce the length of msg by 1
+        msg[len] = '\0';    //set erased character to ASCII null
     }
+    else morseAbort();      //with nothing to delete, stop the message being played
+    wordcells = (len == 0 || msg[len-1] == ' ') ? 0 : -1; //the cells making up the word are no longer known
 }
 
-//send(): run forever by sendThread.When it receives a signal from the sendISR,
-//it will call printMorse, which outputs the stored message as morse code and erases the message.
-void send() {
-    //loop forever
-    while (1) {
-        sendlock.lock();    //lock send mutex to protect from bounce
-        sendCond.wait();    //wait for a signal from the ISR
-        sendlock.unlock();  //unlock send mutex
-        printMorse();       //call function to output the message as morse code
+//debounceSample(): called by debounceTicker every millisecond. Reads all nine pins, steps each
+//integrator, and posts an event to the queue when enter, backspace or send is pressed or released.
+//An enter press carries the debounced bumps as its chord, latched at that sample.
+void debounceSample() {
+    wakes[WAKE_DEBOUNCE]++;
+    checkIn(CTX_DEBOUNCE, 1);
+    int raw = bumps.read() | enterButton.read() << 6 | backspaceButton.read() << 7 | sendButton.read() << 8;
+    int settle = debounceSettle;
+    uint16_t changed = 0;   //pins whose debounced state changed this sample
+    bool settled = true;    //every pin reads released and has settled there
+    for (int i = 0; i < DEBOUNCE_PINS; i++) {
+        uint16_t bit = 1 << i;
+        if (debounceCount[i] > settle) debounceCount[i] = settle;  //the settle time was shortened
+        if (raw & bit) {
+            if (debounceCount[i] < settle) debounceCount[i]++;
+            if (debounceCount[i] == settle && !(debounceState & bit)) changed |= bit;   //now pressed
+        }
+        else {
+            if (debounceCount[i] > 0) debounceCount[i]--;
+            if (debounceCount[i] == 0 && (debounceState & bit)) changed |= bit;        //now released
+        }
+        if (debounceCount[i] != 0) settled = false;
+        else if (i >= 6) buttonEdge[i - 6] = 0;    //a released button's next raw edge starts a new press
+    }
+    debounceState ^= changed;
+    if (settled && debounceState == 0) {    //nothing is down; stop sampling so the MCU can deep sleep
+        CriticalSectionLock lock;
+        debounceTicker.detach();
+        debounceRunning = false;
+        contextDue[CTX_DEBOUNCE] = 0;
+        powerLoad(LOAD_AWAKE, false);
+    }
+    if (changed == 0) return;
+
+    uint32_t now = us_ticker_read();
+    int chord = debounceState & 0b111111;  //bumps held right now
+    static const InputEvent presses[3] = {EV_ENTER, EV_BACKSPACE, EV_SEND};
+    for (int i = 0; i < 3; i++) {
+        uint16_t bit = 1 << (6 + i);
+        uint32_t edge = buttonEdge[i] != 0 ? buttonEdge[i] : now;  //the raw edge, if debounceWake caught it
+        if (changed & bit) queue.call(&buttonEvent, (debounceState & bit) ? presses[i] : EV_RELEASE, chord, edge);
     }
 }
 
-//enterISR(): When the enter button is pressed, this ISR will signal enterThread.
-void enterISR() {
-    enterlock.lock();       //lock the enter mutex so it can signal
-    enterCond.notify_all(); //signal enterThread
-    enterlock.unlock();     //unlock enter mutex
+//debounceWake(): called on a rising edge of enter, backspace or send. Stamps the first raw edge of each
+//button that reads pressed, for the latency, and starts the debouncer if it is stopped, which then samples
+//every pin, bumps included, until they have all settled released again.
+void debounceWake() {
+    CriticalSectionLock lock;   //the ticker may be stopping itself
+    uint32_t now = us_ticker_read();
+    int raw = enterButton.read() | backspaceButton.read() << 1 | sendButton.read() << 2;
+    for (int i = 0; i < 3; i++)
+        if ((raw & (1 << i)) && buttonEdge[i] == 0) buttonEdge[i] = now != 0 ? now : 1;    //0 means none
+    if (debounceRunning) return;
+    wakes[WAKE_BUTTON]++;
+    debounceRunning = true;
+    powerLoad(LOAD_AWAKE, true);
+    checkIn(CTX_DEBOUNCE, 1);
+    debounceTicker.attach(&debounceSample, 1ms);    //sample the buttons at 1kHz
 }
 
-//backspaceISR(): When the backspace button is pressed, this ISR will signal backspaceThread.
-void backspaceISR() {
-    backspacelock.lock();       //lock the backspace mutex so it can signal
-    backspaceCond.notify_all(); //signal backspaceThread
-    backspacelock.unlock();     //unlock backspace mutex
+//nowMs(): milliseconds since startup from the kernel clock, which keeps counting through deep sleep
+uint32_t nowMs() {
+    return (uint32_t) Kernel::Clock::now().time_since_epoch().count();
 }
 
-//sendISR(): When the send button is pressed, this ISR will signal sendThread.
-void sendISR() {
-    sendlock.lock();        //lock the send mutex so it can signal
-    sendCond.notify_all();  //signal sendThread
-    sendlock.unlock();      //unlock send mutex
+//checkIn(): records that a context is alive and will run again within delay milliseconds
+void checkIn(Context ctx, uint32_t delay) {
+    uint32_t due = nowMs() + delay;
+    contextDue[ctx] = due != 0 ? due : 1;   //0 means idle
 }
 
-void brailleToText() {
-    //input is in the following order:
-    // TL ML BL TR MR BR
-    msglock.lock(); //lock mutex protecting msg
-    if (len >= 140) {   //if string is at maximum size
-        msglock.unlock();   //unlock msg mutex
-        //vibrate motor for a long time to denote an error
-        braillevibrate = 1;
-        ThisThread::sleep_for(500ms);
-        braillevibrate = 0;
-        return;
+//powerLoad(): turns a load on or off in the power accounting, adding up how long it was on
+void powerLoad(Load load, bool on) {
+    CriticalSectionLock lock;   //loads change in interrupts and on the event queue
+    if (loadOn[load] == on) return;
+    uint32_t now = nowMs();
+    if (on) loadSince[load] = now;
+    else loadTime[load] += now - loadSince[load];
+    loadOn[load] = on;
+}
+
+//debounceSettleTime(): sets how many milliseconds a pin must read the same before it changes state
+void debounceSettleTime(int ms) {
+    debounceSettle = ms < 1 ? 1 : ms > 255 ? 255 : ms;  //integrators are 8 bits
+}
+
+//healthCheck(): kicks the watchdog only if the system is healthy: this runs on the event queue, so the
+//queue is being dispatched, and every active interrupt context has run when it was due. If one has
+//stalled, the watchdog is left to restart the system.
+void healthCheck() {
+    wakes[WAKE_HEALTH]++;
+    uint32_t now = nowMs();
+    bool ok = true;
+    for (int i = 0; i < CONTEXTS; i++) {
+        uint32_t due = contextDue[i];
+        if (due != 0 && (int32_t) (now - due) > HEALTH_SLACK) {    //active and overdue
+            if (healthy) printf("health: %s stalled %lums ago\n", contextNames[i], (unsigned long) (now - due));
+            ok = false;
+        }
+    }
+    healthy = ok;
+    if (healthy) Watchdog::get_instance().kick();
+}
+
+//printStats(): prints the keypress latency, the time spent in each power state with an estimate of
+//the mean current, the wakeups from each source and, as enabled in mbed_app.json
+//(platform.stack-stats-enabled, platform.heap-stats-enabled), stack and heap use.
+//Called when send is pressed with every bump held.
+void printStats() {
+    printf("latency: last %luus max %luus\n", (unsigned long) latencyLast, (unsigned long) latencyMax);
+
+    uint64_t on[LOADS];     //milliseconds each load has been on, up to now
+    uint32_t now;
+    {
+        CriticalSectionLock lock;
+        now = nowMs();
+        for (int i = 0; i < LOADS; i++) on[i] = loadTime[i] + (loadOn[i] ? now - loadSince[i] : 0);
     }
+    uint64_t asleep = now > on[LOAD_AWAKE] ? now - on[LOAD_AWAKE] : 0;
+    uint64_t charge = asleep * CURRENT_DEEP_SLEEP + on[LOAD_AWAKE] * CURRENT_AWAKE + on[LOAD_BRAILLE] * CURRENT_MOTOR
+                    + on[LOAD_MORSE] * (CURRENT_MOTOR + CURRENT_LED);   //microamp milliseconds
+    printf("power: deep sleep %llums, awake %llums, braille motor %llums, morse %llums, mean %lluuA\n",
+           (unsigned long long) asleep, (unsigned long long) on[LOAD_AWAKE], (unsigned long long) on[LOAD_BRAILLE],
+           (unsigned long long) on[LOAD_MORSE], (unsigned long long) (now > 0 ? charge / now : 0));
+    printf("wakes: button %lu debounce %lu morse %lu feedback %lu health %lu\n", (unsigned long) wakes[WAKE_BUTTON],
+           (unsigned long) wakes[WAKE_DEBOUNCE], (unsigned long) wakes[WAKE_MORSE],
+           (unsigned long) wakes[WAKE_FEEDBACK], (unsigned long) wakes[WAKE_HEALTH]);
+#if MBED_STACK_STATS_ENABLED
+    mbed_stats_stack_t stacks[4];   //main, idle and timer threads, and one spare
+    int n = mbed_stats_stack_get_each(stacks, 4);
+    for (int i = 0; i < n; i++)
+        printf("stack %lx: %lu of %lu bytes\n", (unsigned long) stacks[i].thread_id,
+               (unsigned long) stacks[i].max_size, (unsigned long) stacks[i].reserved_size);
+#endif
+#if MBED_HEAP_STATS_ENABLED
+    mbed_stats_heap_t heap;
+    mbed_stats_heap_get(&heap);
+    printf("heap: %lu bytes, max %lu, reserved %lu\n", (unsigned long) heap.current_size,
+           (unsigned long) heap.max_size, (unsigned long) heap.reserved_size);
+#endif
+}
+
+//brailleToText(): reads the input variable, decodes it as a braille cell and adds the result to msg
+void brailleToText() {
+    CellResult result = appendCell(input & 0b111111);   //decode the cell into msg
+    cellFeedback(result);   //let the user feel whether it worked
+}
+
+//appendCell(): decodes cell c in the current mode and adds its text to msg.
+//Number mode is marked by a '#' at the end of msg, which each digit is written in front of.
+CellResult appendCell(int c) {
+    if (len >= MSG_MAX) return CELL_FULL;   //string is at maximum size
+
     //number characters
-    if (len > 0 && msg[len-1] == '#'){    //if number key was just input
-        inputlock.lock();   //lock input mutex
-        switch (input){
-            case 0b000000: msg[len-1] = ' '; msg[len] = '#'; len ++; break; // blank = space
-            case 0b100000: msg[len-1] = '1'; msg[len] = '#'; len ++; break; // ⠁ = 1
-            case 0b110000: msg[len-1] = '2'; msg[len] = '#'; len ++; break; // ⠃ = 2
-            case 0b100100: msg[len-1] = '3'; msg[len] = '#'; len ++; break; // ⠉ = 3
-            case 0b100110: msg[len-1] = '4'; msg[len] = '#'; len ++; break; // ⠙ = 4
-            case 0b100010: msg[len-1] = '5'; msg[len] = '#'; len ++; break; // ⠑ = 5
-            case 0b110100: msg[len-1] = '6'; msg[len] = '#'; len ++; break; // ⠋ = 6
-            case 0b110110: msg[len-1] = '7'; msg[len] = '#'; len ++; break; // ⠛ = 7
-            case 0b110010: msg[len-1] = '8'; msg[len] = '#'; len ++; break; // ⠓ = 8
-            case 0b010100: msg[len-1] = '9'; msg[len] = '#'; len ++; break; // ⠊ = 9
-            case 0b010110: msg[len-1] = '0'; msg[len] = '#'; len ++; break; // ⠚ = 0
-            case 0b000011: len--; msg[len] = '\0'; break; // ⠰ = switch back to letters by removing '#'
-            default:    //invalid input
-                msglock.unlock(); //unlock msg mutex
-                inputlock.unlock(); //unlock input mutex
-                //vibrate motor for a long time to denote an error
-                braillevibrate = 1;
-                ThisThread::sleep_for(500ms);
-                braillevibrate = 0;
-                return;
+    if (len > 0 && msg[len-1] == '#') {     //if number key was just input
+        if (c == MODE_SIGN) {               //⠰ = switch back to letters by removing '#'
+            len--;
+            msg[len] = '\0';
+            return CELL_OK;
         }
-        inputlock.unlock(); //unlock input mutex
+        char ch = numberTable.entry[c];     //look the cell up
+        if (ch == 0) return CELL_INVALID;
+        msg[len-1] = ch;                    //replace the '#' with the character
+        msg[len++] = '#';                   //and move the '#' after it
+        wordcells = ch == ' ' ? 0 : -1;     //numbers are never wordsigns
+        return CELL_OK;
+    }
 
+    //two-cell symbols
+    if (symbol) {                           //the cell after ⠸
+        symbol = false;
+        if (c != SLASH) return CELL_INVALID;
+        if (!appendText("/", len)) return CELL_FULL;
+        wordcells = -1;                     //a word with a symbol in it is not a wordsign
+        return CELL_OK;
+    }
+    if (c == SYMBOL_SIGN) {
+        symbol = true;
+        return CELL_OK;
     }
+
     //non-number characters
-    else {
-        inputlock.lock();   //lock input mutex
-        switch (input){
-            case 0b000000: msg[len] = ' '; len++; break; // blank space
-            case 0b100000: msg[len] = 'a'; len++; break; // ⠁ = a
-            case 0b110000: msg[len] = 'b'; len++; break; // ⠃ = b
-            case 0b100100: msg[len] = 'c'; len++; break; // ⠉ = c
-            case 0b100110: msg[len] = 'd'; len++; break; // ⠙ = d
-            case 0b100010: msg[len] = 'e'; len++; break; // ⠑ = e
-            case 0b110100: msg[len] = 'f'; len++; break; // ⠋ = f
-            case 0b110110: msg[len] = 'g'; len++; break; // ⠛ = g
-            case 0b110010: msg[len] = 'h'; len++; break; // ⠓ = h
-            case 0b010100: msg[len] = 'i'; len++; break; // ⠊ = i
-            case 0b010110: msg[len] = 'j'; len++; break; // ⠚ = j
-            case 0b101000: msg[len] = 'k'; len++; break; // ⠅ = k
-            case 0b111000: msg[len] = 'l'; len++; break; // ⠇ = l
-            case 0b101100: msg[len] = 'm'; len++; break; // ⠍ = m
-            case 0b101110: msg[len] = 'n'; len++; break; // ⠝ = n
-            case 0b101010: msg[len] = 'o'; len++; break; // ⠕ = o
-            case 0b111100: msg[len] = 'p'; len++; break; // ⠏ = p
-            case 0b111110: msg[len] = 'q'; len++; break; // ⠟ = q
-            case 0b111010: msg[len] = 'r'; len++; break; // ⠗ = r
-            case 0b011100: msg[len] = 's'; len++; break; // ⠎ = s
-            case 0b011110: msg[len] = 't'; len++; break; // ⠞ = t
-            case 0b101001: msg[len] = 'u'; len++; break; // ⠥ = u
-            case 0b111001: msg[len] = 'v'; len++; break; // ⠧ = v
-            case 0b010111: msg[len] = 'w'; len++; break; // ⠺ = w
-            case 0b101101: msg[len] = 'x'; len++; break; // ⠭ = x
-            case 0b101111: msg[len] = 'y'; len++; break; // ⠽ = y
-            case 0b101011: msg[len] = 'z'; len++; break; // ⠵ = z
-            case 0b001111: msg[len] = '#'; len++; break; // ⠼ = switch to numbers by adding a '#'
-            default: // invalid input
-                msglock.unlock(); //unlock mutex protecting msg
-                inputlock.unlock(); //unlock input mutex
-                //vibrate motor for a long time to denote an error
-                braillevibrate = 1;
-                ThisThread::sleep_for(500ms);
-                braillevibrate = 0;
-                return;
+    if (c == NUMBER_SIGN) {                 //⠼ = switch to numbers by adding a '#'
+        msg[len++] = '#';
+        wordcells = -1;
+        return CELL_OK;
+    }
+    if (c == MODE_SIGN) {                   //⠰ = turn Grade 2 contractions on or off
+        grade2 = !grade2;
+        return CELL_MODE;
+    }
+    if (c == 0) {                           //blank = space, which ends a word
+        if (!expandWordsign(1)) return CELL_FULL;   //no room for the word and the space
+        msg[len++] = ' ';
+        wordcells = 0;
+        return CELL_OK;
+    }
+
+    const char *text = grade2 ? contractionTable.entry[c] : nullptr;   //Grade 2 contraction, if there is one
+    char single[2] = {letterTable.entry[c], '\0'};                     //otherwise a single letter or punctuation mark
+    if (text == nullptr) {
+        if (single[0] == 0) return CELL_INVALID;
+        if (single[0] == '(') {             //⠶ is a closing parenthesis if one is open
+            int open = 0;
+            for (int i = 0; i < len; i++) open += msg[i] == '(' ? 1 : msg[i] == ')' ? -1 : 0;
+            if (open > 0) single[0] = ')';
         }
-        inputlock.unlock(); //unlock input mutex
+        text = single;
     }
-    // character has been added to msg
-    msglock.unlock(); //unlock mutex protecting msg
-    //vibrate motor for a short time to denote successful character entry
-    braillevibrate = 1;
-    ThisThread::sleep_for(100ms);
-    braillevibrate = 0;
-    return;
-}
-
-//dot(): outputs a morse code "dot" to the vibration motor and LED
-void dot() {
-    morsevibrate = 1;   //turn on motor
-    GPIOB->ODR |= 2;    //turn on led
-    ThisThread::sleep_for(100ms);   //dots last for 1 unit (100ms)
-    morsevibrate = 0;   //turn off motor
-    GPIOB->ODR &= ~2;   //turn off led
-    ThisThread::sleep_for(100ms);   //pauses between parts of a letter are one unit (100ms)
-}
-//dash(): outputs a morse code "dash" to the vibration motor and LED
-void dash() {
-    morsevibrate = 1;   //turn on motor
-    GPIOB->ODR |= 2;    //turn on led
-    ThisThread::sleep_for(300ms);   //dashes last for 3 units (300ms)
-    morsevibrate = 0;   //turn off motor
-    GPIOB->ODR &= ~2;   //turn off led
-    ThisThread::sleep_for(100ms);   //pauses between parts of a letter are one unit (100ms)
-}
-
-//printMorse(): reads the msg string and outputs it as morse code via the vibration motor and LED
+    int before = len;
+    if (!appendText(text, len)) return CELL_FULL;
+    lastcell = c;                           //remember the cell in case it turns out to be a wordsign
+    lastlen = len - before;
+    if (wordcells >= 0) wordcells++;
+    return CELL_OK;
+}
+
+//expandWordsign(): called when a word ends, by a space or by sending. In Grade 2, a word made of a
+//single cell is replaced by that cell's wordsign. Returns false and leaves msg alone if the word and the
+//after characters that follow it do not fit.
+bool expandWordsign(int after) {
+    const char *word = grade2 && wordcells == 1 ? wordsignTable.entry[lastcell] : nullptr;
+    if (word == nullptr) return len + after <= MSG_MAX;    //not a wordsign
+    if (len - lastlen + (int) strlen(word) + after > MSG_MAX) return false;
+    appendText(word, len - lastlen);    //replace the cell's text with the word
+    wordcells = -1;     //the word is spelled out now, so it can't be expanded again
+    return true;
+}
+
+//appendText(): writes text into msg starting at position from, replacing everything after it.
+//Returns false and leaves msg alone if the text does not fit.
+bool appendText(const char *text, int from) {
+    int n = strlen(text);
+    if (from + n > MSG_MAX) return false;
+    memcpy(msg + from, text, n);    //write the text
+    for (int i = from + n; i < len; i++) msg[i] = '\0';    //clear anything left past its end
+    len = from + n;
+    return true;
+}
+
+//cellFeedback(): starts vibrating the keyboard motor: one short pulse for a character, one long pulse
+//for an error, and two short pulses when Grade 2 is turned on or off. The pattern is played by
+//feedbackStep() from the event queue, so the next keystroke is taken while it plays; a new pattern
+//cuts off the one before it.
+void cellFeedback(CellResult result) {
+    if (feedbackId != 0) queue.cancel(feedbackId);  //stop the last pattern
+    int pulses = result == CELL_MODE ? 2 : 1;   //number of pulses
+    feedbackLength = (result == CELL_INVALID || result == CELL_FULL) ? 500ms : 100ms;  //length of each pulse
+    feedbackEdges = 2 * pulses - 1;     //no pause is needed after the last pulse
+    feedbackStep();
+}
+
+//feedbackStep(): turns the keyboard motor on for a pulse or off for the 100ms pause after it,
+//and schedules the next step
+void feedbackStep() {
+    if (feedbackId != 0) wakes[WAKE_FEEDBACK]++;   //called by the queue's timer, not by cellFeedback()
+    int on = feedbackEdges % 2 == 1;    //patterns start with the motor on
+    braillevibrate = on;
+    powerLoad(LOAD_BRAILLE, on);
+    feedbackId = 0;
+    if (feedbackEdges == 0) return;     //the motor is off and the pattern is done
+    feedbackEdges--;
+    feedbackId = queue.call_in(on ? feedbackLength : std::chrono::milliseconds(100), &feedbackStep);
+}
+
+//printMorse(): moves the msg string into the outbox and starts the morse player if it is idle; the motor
+//and LED are then driven by morseTimer, so the calling thread does not wait for the message to be played.
+//With nothing typed, skips ahead to the next word of the message playing instead.
 void printMorse() {
-    msglock.lock(); //lock msg mutex
-    char msgcpy[140] = {};  //create string to copy msg
-    //copy msg into msgcopy and clear msg
-    for (int i = 0; i < len && msg[i] != '\0'; i++) {msgcpy[i] = msg[i]; msg[i] = '\0';}    //copy msg into msgcopy; clear msg
-    int lencpy = len;   //create copy of len
+    symbol = false;     //a ⠸ with no second cell is dropped
+    if (len == 0) {     //nothing to send
+        morseSkip();
+        return;
+    }
+    if (!expandWordsign(0)) {    //the last word ends here, so it can be a wordsign too
+        cellFeedback(CELL_FULL);    //no room for it; msg is kept to be edited
+        return;
+    }
+    if (!outboxPush(msg, len)) {    //copy msg into the outbox
+        cellFeedback(CELL_FULL);    //outbox is full; msg is kept to be sent later
+        return;
+    }
+    memset(msg, 0, len);    //clear msg
     len = 0;    //set len to 0
-    msglock.unlock();   //unlock msg mutex; msg was copied to free this up sooner
-
-    //loop through each character in msgcopy
-    for (int i = 0; i < lencpy && msgcpy[i] != '\0'; i++) {
-        switch (msgcpy[i]) {   //look at the character
-            case ' ': ThisThread::sleep_for(200ms); break;//spaces between words take 7 units of time total (1 unit = 100ms)
-            case 'a': dot(); dash();                    break; //a: .-
-            case 'b': dash(); dot(); dot(); dot();      break; //b: -...
-            case 'c': dash(); dot(); dash(); dot();     break; //c: -.-.
-            case 'd': dash(); dot(); dot();             break; //d: -..
-            case 'e': dot();                            break; //e: .
-            case 'f': dot(); dot(); dash(); dot();      break; //f: ..-.
-            case 'g': dash(); dash(); dot();            break; //g: --.
-            case 'h': dot(); dot(); dot(); dot();       break; //h: ....
-            case 'i': dot(); dot();                     break; //i: ..
-            case 'j': dot(); dash(); dash(); dash();    break; //j: .---
-            case 'k': dash(); dot(); dash();            break; //k: -.-
-            case 'l': dot(); dash(); dot(); dot();      break; //l: .-..
-            case 'm': dash(); dash();                   break; //m: --
-            case 'n': dash(); dot();                    break; //n: -.
-            case 'o': dash(); dash(); dash();           break; //o: ---
-            case 'p': dot(); dash(); dash(); dot();     break; //p: .--.
-            case 'q': dash(); dash(); dot(); dash();    break; //q: --.-
-            case 'r': dot(); dash(); dot();             break; //r: .-.
-            case 's': dot(); dot(); dot();              break; //s: ...
-            case 't': dash();                           break; //t: -
-            case 'u': dot(); dot(); dash();             break; //u: ..-
-            case 'v': dot(); dot(); dot(); dash();      break; //v: ...-
-            case 'w': dot(); dash(); dash();            break; //w: .--
-            case 'x': dash(); dot(); dot(); dash();     break; //x: -..-
-            case 'y': dash(); dot(); dash(); dash();    break; //y: -.--
-            case 'z': dash(); dash(); dot(); dot();     break; //z: --..
-            case '0': dash(); dash(); dash(); dash(); dash(); break;    //0: -----
-            case '1': dot();  dash(); dash(); dash(); dash(); break;    //1: .----
-            case '2': dot();  dot();  dash(); dash(); dash(); break;    //2: ..---
-            case '3': dot();  dot();  dot();  dash(); dash(); break;    //3: ...--
-            case '4': dot();  dot();  dot();  dot();  dash(); break;    //4: ....-
-            case '5': dot();  dot();  dot();  dot();  dot();  break;    //5: .....
-            case '6': dash(); dot();  dot();  dot();  dot();  break;    //6: -....
-            case '7': dash(); dash(); dot();  dot();  dot();  break;    //7: --...
-            case '8': dash(); dash(); dash(); dot();  dot();  break;    //8: ---..
-            case '9': dash(); dash(); dash(); dash(); dot();  break;    //9: ----.
-            case '#': break;    //ignore number marker if it was left in by user
-        }
-        ThisThread::sleep_for(200ms);   //sleep for 200ms to make a pause between letters 3 time units in total
+    wordcells = 0;  //the next cell starts a new word
+    morseKick();    //make sure the player is running
+}
+
+//outboxPush(): copies a message of n characters into the next free outbox slot and publishes it.
+//Returns false if every slot is taken. Only called from the event queue.
+bool outboxPush(const char *text, int n) {
+    unsigned head = outboxHead.load(std::memory_order_relaxed);
+    if (head - outboxTail.load(std::memory_order_acquire) == OUTBOX_SIZE) return false;   //full
+    char *slot = outbox[head % OUTBOX_SIZE];
+    memcpy(slot, text, n);
+    slot[n] = '\0';
+    outboxHead.store(head + 1, std::memory_order_release);  //the slot is written before it is published
+    return true;
+}
+
+//outboxFront(): returns the oldest message in the outbox, or nullptr if it is empty. Only called by the player.
+const char *outboxFront() {
+    unsigned tail = outboxTail.load(std::memory_order_relaxed);
+    if (outboxHead.load(std::memory_order_acquire) == tail) return nullptr;  //empty
+    return outbox[tail % OUTBOX_SIZE];
+}
+
+//outboxPop(): frees the oldest message's slot for the producer to reuse. Only called by the player.
+void outboxPop() {
+    outboxTail.store(outboxTail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+//morseSpeed(): sets the timing for a character speed of wpm words per minute. With Farnsworth timing,
+//the gaps between characters and words are stretched so that the overall speed is farnsworth words
+//per minute, while each character keeps its full speed.
+void morseSpeed(int wpm, int farnsworth) {
+    if (farnsworth > wpm) farnsworth = wpm; //Farnsworth can only slow the gaps down
+    uint32_t unit = 1200000 / wpm;  //PARIS is 50 units, so a unit is 1.2s / wpm
+    //the 19 gap units of PARIS take 60/s - 37.2/c seconds at an overall speed of s and character speed of c,
+    //since its other 31 units take 31 * 1.2/c
+    uint32_t gaps = (uint32_t) ((60000000LL * wpm - 31LL * 1200000 * farnsworth) / ((long long) wpm * farnsworth));
+    CriticalSectionLock lock;   //the timer callback reads these
+    morseUnit = unit;
+    morseLetterGap = 3 * gaps / 19; //3 of the 19 gap units separate characters
+    morseWordGap = 7 * gaps / 19;   //7 of them separate words
+}
+
+//morseStep(): called by morseTimer at the end of each on or off period. Turns the current element on,
+//or turns it off and moves on to the next element or character, and sets the timer for the next edge.
+void morseStep() {
+    wakes[WAKE_MORSE]++;
+    MorseCode code = morseTable.entry[(int) morseText[morsePos]];   //code of the character being played
+    if (!morseOn) {     //a gap has ended; start the element
+        morseOutput(1);
+        bool dash = code.dashes & (1 << morseElement);
+        morseSchedule(dash ? 3 * morseUnit : morseUnit);
+        return;
+    }
+    morseOutput(0);     //the element has ended
+    if (++morseElement < code.count) {  //more elements in this character
+        morseSchedule(morseUnit);
+        return;
+    }
+    morseNext(morsePos + 1, morseLetterGap);    //move on to the next character
+}
+
+//morseNext(): finds the next character with a code at or after from and sets the timer for the gap
+//before it: a word gap if a space was passed, otherwise the given gap.
+//Ends the message if there are no characters left.
+void morseNext(int from, uint32_t gap) {
+    bool space = false;
+    for (; morseText[from] != '\0'; from++) {  //skip characters without a code
+        unsigned char ch = morseText[from];
+        if (ch < 128 && morseTable.entry[ch].count > 0) break;
+        if (ch == ' ') space = true;
+    }
+    if (morseText[from] == '\0') { //nothing left to play
+        morseFinish();
+        return;
     }
-}
\ No newline at end of file
+    morsePos = from;
+    morseElement = 0;
+    if (space && gap < morseWordGap) gap = morseWordGap;
+    morseSchedule(gap);
+}
+
+//morseSchedule(): sets morseTimer to call morseStep() after us microseconds, and checks the player in
+//as due to run then
+void morseSchedule(uint32_t us) {
+    checkIn(CTX_MORSE, us / 1000 + 1);
+    morseTimer.attach(&morseStep, std::chrono::microseconds(us));
+}
+
+//morseBegin(): starts playing the oldest message in the outbox after the given gap, or leaves the player idle
+void morseBegin(uint32_t gap) {
+    morseText = outboxFront();
+    morseBusy = morseText != nullptr;
+    if (morseBusy) morseNext(0, gap);
+    else contextDue[CTX_MORSE] = 0;     //idle; nothing to check
+}
+
+//morseFinish(): frees the slot of the message that was playing and starts the next one a word gap later
+void morseFinish() {
+    outboxPop();
+    morseBegin(morseWordGap);
+}
+
+//morseKick(): starts the morse player on the outbox if it is idle. Interrupts are disabled so the
+//player cannot go idle between the check and the start, stranding a message in the outbox.
+void morseKick() {
+    CriticalSectionLock lock;
+    if (!morseBusy) morseBegin(0);
+}
+
+//morseOutput(): turns the morse vibration motor and LED on or off
+void morseOutput(int on) {
+    morseOn = on;
+    powerLoad(LOAD_MORSE, on);
+    morsevibrate = on;  //motor
+    if (on) GPIOB->ODR |= 2;    //turn on led
+    else GPIOB->ODR &= ~2;      //turn off led
+}
+
+//morseSkip(): cuts off the word being played and moves on to the next one
+void morseSkip() {
+    CriticalSectionLock lock;   //keep the timer callback out while the player is changed
+    if (!morseBusy) return;
+    morseTimer.detach();
+    morseOutput(0);
+    int i = morsePos;
+    while (morseText[i] != '\0' && morseText[i] != ' ') i++;  //find the end of the word
+    morseNext(i, morseLetterGap);
+}
+
+//morseAbort(): stops the message being played and moves on to the next one in the outbox
+void morseAbort() {
+    CriticalSectionLock lock;   //keep the timer callback out while the player is changed
+    if (!morseBusy) return;
+    morseTimer.detach();
+    morseOutput(0);
+    morseFinish();
+}
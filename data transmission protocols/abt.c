@@ -1,4 +1,10 @@
-#include "../include/simulator.h"
+#include "simulator.h"
+#include "conn.h"
+#include "metrics.h"
+#include "packet.h"
+#include "pool.h"
+#include "rtt.h"
+#include "sendbuf.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,24 +24,66 @@
 
 struct queue_elem {
     struct pkt *pkt;
+    float queued;   // when layer 5 handed the message over
     struct queue_elem *next;
 };
 
 struct pktqueue {
     struct queue_elem *front;
     struct queue_elem *back;
+    struct pool elem_pool;
 };
 
-struct pktqueue *buffer;
-struct pkt *a_currentpkt;
-int a_sendnum;
-int b_pktnum;
+// Everything one A-to-B connection knows, on both sides
+struct abt_conn {
+    int id;
+    struct pktqueue buffer;
+    struct pkt *a_currentpkt;
+    float a_queued;
+    float a_sent_time;
+    int a_retransmitted;
+    struct rtt_estimator a_rtt;
+    struct pool a_pool;
+    struct sendbuf a_sendbuf;   // counts a_currentpkt and everything queued behind it
+    int a_sendnum;
+    int a_nextseq;
+    int b_pktnum;
+    struct metrics a_metrics;
+    struct metrics b_metrics;
+};
+
+struct conn_table conns;
+
+#define TIMEOUT 20
+#define BUFFERSIZE 16
+// seqnum of a negative ack, which asks A to resend the packet numbered in its acknum
+#define NAK -1
+
+// Put a_currentpkt on the wire for the first time and start its timer
+void send_current(struct abt_conn *c) {
+  conn_tolayer3(c->id, 0, *c->a_currentpkt);
+  metrics_count(&c->a_metrics, METRIC_SENT);
+  c->a_sent_time = get_sim_time();
+  c->a_retransmitted = 0;
+  conn_starttimer(c->id, 0, rtt_timeout(&c->a_rtt));
+}
+
+// Resend a_currentpkt now, without waiting for its timer, and restart the timer.
+// This isn't a timeout, so the timeout isn't backed off.
+void resend_current(struct abt_conn *c) {
+  conn_stoptimer(c->id, 0);
+  conn_tolayer3(c->id, 0, *c->a_currentpkt);
+  metrics_count(&c->a_metrics, METRIC_RETRANSMITTED);
+  c->a_retransmitted = 1;
+  conn_starttimer(c->id, 0, rtt_timeout(&c->a_rtt));
+}
 
-// Add packet to queue
-void queue(struct pktqueue *queue, struct pkt* packet) {
-    struct queue_elem *new_elem = (struct queue_elem *) malloc(sizeof(struct queue_elem));
+// Add packet to queue, with the time its message was handed over
+void queue(struct pktqueue *queue, struct pkt* packet, float queued) {
+    struct queue_elem *new_elem = (struct queue_elem *) pool_acquire(&queue->elem_pool);
     new_elem->next = NULL;
     new_elem->pkt = packet;
+    new_elem->queued = queued;
     if (queue->back == NULL) {
         if (queue->front == NULL) {
             queue->front = new_elem;
@@ -47,120 +95,235 @@ void queue(struct pktqueue *queue, struct pkt* packet) {
     queue->back = new_elem;
 }
 
-// Get packet from front of queue
-struct pkt *dequeue(struct pktqueue *queue) {
+// Get packet from front of queue, and the time its message was handed over
+struct pkt *dequeue(struct pktqueue *queue, float *queued) {
     if (queue->front == NULL) return NULL;
     struct queue_elem *output_elem = queue->front;
     queue->front = queue->front->next;
     if (queue->front == queue->back) queue->back = NULL;
     struct pkt *output = output_elem->pkt;
-    free(output_elem);
+    *queued = output_elem->queued;
+    pool_release(&queue->elem_pool, output_elem);
     return output;
 }
 
 /********* STUDENTS WRITE THE NEXT SIX ROUTINES *********/
 
 /* called from layer 5, passed the data to be sent to other side */
-void A_output(message)
+int conn_A_output(conn, message)
+  int conn;
   struct msg message;
 {
+  struct abt_conn *c = (struct abt_conn *) conn_find(&conns, conn);
+  // Refuse the message if the send buffer is full; layer 5 tries again once it drains
+  if (sendbuf_admit(&c->a_sendbuf) == SEND_WOULDBLOCK) return SEND_WOULDBLOCK;
   // Create packet
-  struct pkt *newpkt = (struct pkt *) malloc(sizeof(struct pkt));
-  newpkt->acknum = 0;
-  newpkt->seqnum = a_sendnum;
-  newpkt->checksum = a_sendnum;
-  for (int i = 0;i<20;i++) {
-    newpkt->checksum += message.data[i];
-    newpkt->payload[i] = message.data[i];
-  }
+  struct pkt *newpkt = (struct pkt *) pool_acquire(&c->a_pool);
+  make_pkt(newpkt, c->a_nextseq, 0, message.data);
+  c->a_nextseq++;
   // If packet not ready to be sent, queue it:
-  if (a_currentpkt != NULL) queue(buffer, newpkt);
+  if (c->a_currentpkt != NULL) queue(&c->buffer, newpkt, get_sim_time());
   // Otherwise, send it off:
   else {
-    a_currentpkt = newpkt;
-    tolayer3(0, *newpkt);
-    starttimer(0, 20);
+    c->a_currentpkt = newpkt;
+    c->a_queued = get_sim_time();
+    send_current(c);
   }
+  metrics_gauge(&c->a_metrics, METRIC_SEND_QUEUE, c->a_sendbuf.stats.depth);
+  metrics_gauge(&c->a_metrics, METRIC_WINDOW, 1);
+  metrics_gauge(&c->a_metrics, METRIC_POOL, c->a_pool.in_use + c->buffer.elem_pool.in_use);
+  return SEND_OK;
 }
 
 /* called from layer 3, when a packet arrives for layer 4 */
-void A_input(packet)
+void conn_A_input(conn, packet)
+  int conn;
   struct pkt packet;
 {
-  // Validate checksum
-  int check = packet.acknum;
-  for (int i=0;i<20;i++) check += packet.payload[i];
-  // If checksum is valid:
-  if (check == packet.checksum) {
-    // if ack applies to current sent packet:
-    if (packet.acknum == a_sendnum) {
-      stoptimer(0);
-      a_sendnum++;
-      struct pkt *newpkt = dequeue(buffer);
-      free(a_currentpkt);
-      a_currentpkt = newpkt;
-      if (newpkt != NULL) {
-        tolayer3(0, *newpkt);
-        starttimer(0, 20);
-      }
-    }
+  struct abt_conn *c = (struct abt_conn *) conn_find(&conns, conn);
+  if (c->a_currentpkt == NULL) return;
+  // A corrupted reply was B's ack or NAK for the current packet, or a stray
+  // duplicate ack; resending gets a fresh answer in one round trip. A NAK for
+  // the current packet means B got it corrupted.
+  if (!pkt_valid(&packet)) metrics_count(&c->a_metrics, METRIC_CORRUPTED);
+  else if (packet.seqnum == NAK) metrics_count(&c->a_metrics, METRIC_NAKS);
+  else metrics_count(&c->a_metrics, METRIC_ACKS);
+  if (!pkt_valid(&packet) || (packet.seqnum == NAK && packet.acknum == c->a_sendnum)) {
+    resend_current(c);
+    return;
+  }
+  // Anything else but the ack for the current packet is a NAK for an older
+  // packet or a duplicate ack, and is ignored
+  if (packet.seqnum == NAK) return;
+  if (packet.acknum != c->a_sendnum) {
+    metrics_count(&c->a_metrics, METRIC_DUP_ACKS);
+    return;
+  }
+  conn_stoptimer(conn, 0);
+  // Karn's rule: only time packets that were sent once
+  if (!c->a_retransmitted) {
+    rtt_sample(&c->a_rtt, get_sim_time() - c->a_sent_time);
+    metrics_observe(&c->a_metrics, METRIC_RTT, get_sim_time() - c->a_sent_time);
   }
+  metrics_observe(&c->a_metrics, METRIC_ACK_LATENCY, get_sim_time() - c->a_queued);
+  c->a_sendnum++;
+  struct pkt *newpkt = dequeue(&c->buffer, &c->a_queued);
+  pool_release(&c->a_pool, c->a_currentpkt);
+  if (sendbuf_release(&c->a_sendbuf, 1)) conn_sendready(conn, 0);
+  c->a_currentpkt = newpkt;
+  if (newpkt != NULL) send_current(c);
+  metrics_gauge(&c->a_metrics, METRIC_SEND_QUEUE, c->a_sendbuf.stats.depth);
+  metrics_gauge(&c->a_metrics, METRIC_WINDOW, newpkt != NULL);
+  metrics_gauge(&c->a_metrics, METRIC_POOL, c->a_pool.in_use + c->buffer.elem_pool.in_use);
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt()
+void conn_A_timerinterrupt(conn)
+  int conn;
 {
-  tolayer3(0, *a_currentpkt);
-  starttimer(0, 20);
+  struct abt_conn *c = (struct abt_conn *) conn_find(&conns, conn);
+  rtt_backoff(&c->a_rtt);
+  conn_tolayer3(conn, 0, *c->a_currentpkt);
+  metrics_count(&c->a_metrics, METRIC_RETRANSMITTED);
+  c->a_retransmitted = 1;
+  conn_starttimer(conn, 0, rtt_timeout(&c->a_rtt));
 }  
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init()
+void conn_A_init(conn)
+  int conn;
 { 
-  buffer = (struct pktqueue *) malloc(sizeof(struct pktqueue));
-  buffer->back = NULL;
-  buffer->front = NULL;
-  a_currentpkt = NULL;
-  a_sendnum = 0;
+  if (conns.size == 0) conn_table_init(&conns, sizeof(struct abt_conn));
+  struct abt_conn *c = (struct abt_conn *) conn_add(&conns, conn);
+  c->id = conn;
+  c->buffer.back = NULL;
+  c->buffer.front = NULL;
+  int high, low;
+  getwatermarks(&high, &low);
+  sendbuf_init(&c->a_sendbuf, high, low);
+  // Every message the send buffer admits is queued until it is sent, so size
+  // the pools for a full buffer and they never have to grow
+  int capacity = high > BUFFERSIZE ? high : BUFFERSIZE;
+  pool_init(&c->buffer.elem_pool, sizeof(struct queue_elem), capacity);
+  pool_init(&c->a_pool, sizeof(struct pkt), capacity + 1);
+  c->a_currentpkt = NULL;
+  c->a_sendnum = 0;
+  c->a_nextseq = 0;
+  rtt_init(&c->a_rtt, TIMEOUT);
+  metrics_init(&c->a_metrics);
 }
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(packet)
+void conn_B_input(conn, packet)
+  int conn;
   struct pkt packet;
 {
-  // Validate checksum
-  int check = packet.seqnum + packet.acknum;
-  for (int i=0;i<20;i++) check += packet.payload[i];
-  // If checksum is valid:
-  if (check == packet.checksum) {
-    if (packet.seqnum <= b_pktnum) {
-      //create ack message
-      struct pkt *ack = (struct pkt *) malloc(sizeof(struct pkt));
-      ack->acknum = packet.seqnum;
-      ack->seqnum = 0;
-      ack->checksum = packet.seqnum;
-      for (int i=0;i<20;i++) {
-        ack->checksum += packet.payload[i];
-        ack->payload[i] = packet.payload[i];
-      }
-      // send ack message back
-      tolayer3(1, *ack);
-      free(ack);
-      // If next data, deliver to upper layer
-      if (packet.seqnum == b_pktnum) {
-        tolayer5(1, packet.payload);
-        b_pktnum++;
-      }
+  struct abt_conn *c = (struct abt_conn *) conn_find(&conns, conn);
+  // Ask for a corrupted packet again, naming the packet B is waiting for
+  if (!pkt_valid(&packet)) {
+    metrics_count(&c->b_metrics, METRIC_CORRUPTED);
+    struct pkt nak;
+    make_pkt(&nak, NAK, c->b_pktnum, packet.payload);
+    conn_tolayer3(conn, 1, nak);
+    return;
+  }
+  if (packet.seqnum <= c->b_pktnum) {
+    //create ack message
+    struct pkt ack;
+    make_pkt(&ack, 0, packet.seqnum, packet.payload);
+    // send ack message back
+    conn_tolayer3(conn, 1, ack);
+    // If next data, deliver to upper layer
+    if (packet.seqnum == c->b_pktnum) {
+      conn_tolayer5(conn, 1, packet.payload);
+      metrics_count(&c->b_metrics, METRIC_DELIVERED);
+      metrics_observe(&c->b_metrics, METRIC_DELIVERY_LATENCY, get_sim_time() - get_sent_time(1, packet.payload));
+      c->b_pktnum++;
     }
   }
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
+void conn_B_init(conn)
+  int conn;
+{
+  if (conns.size == 0) conn_table_init(&conns, sizeof(struct abt_conn));
+  struct abt_conn *c = (struct abt_conn *) conn_add(&conns, conn);
+  c->id = conn;
+  c->b_pktnum = 0;
+  metrics_init(&c->b_metrics);
+}
+
+/* send buffer statistics for the emulator's summary; only A sends */
+void conn_sendstats(conn, AorB, stats)
+  int conn;
+  int AorB;
+  struct sendstats *stats;
+{
+  struct abt_conn *c = (struct abt_conn *) conn_find(&conns, conn);
+  if (AorB == 0) sendbuf_stats(&c->a_sendbuf, stats);
+  else memset(stats, 0, sizeof(*stats));
+}
+
+/* live metrics for one side of a connection */
+struct metrics *conn_metrics(conn, AorB)
+  int conn;
+  int AorB;
+{
+  struct abt_conn *c = (struct abt_conn *) conn_find(&conns, conn);
+  return AorB == 0 ? &c->a_metrics : &c->b_metrics;
+}
+
+/* protocol state for the emulator's -v dump; only A has an RTT estimator and pools */
+void conn_print(conn, AorB, out)
+  int conn;
+  int AorB;
+  FILE *out;
+{
+  struct abt_conn *c = (struct abt_conn *) conn_find(&conns, conn);
+  if (AorB != 0) return;
+  fprintf(out, "conn %d A rtt ", conn);
+  rtt_print(&c->a_rtt, out);
+  fprintf(out, "conn %d A packet pool ", conn);
+  pool_print(&c->a_pool, out);
+  fprintf(out, "conn %d A queue pool ", conn);
+  pool_print(&c->buffer.elem_pool, out);
+}
+
+/* PA2 entry points: a single connection, number 0 */
+void A_output(message)
+  struct msg message;
+{
+  conn_A_output(0, message);
+}
+
+void A_input(packet)
+  struct pkt packet;
+{
+  conn_A_input(0, packet);
+}
+
+void A_timerinterrupt()
+{
+  conn_A_timerinterrupt(0);
+}
+
+void A_init()
+{
+  conn_A_init(0);
+}
+
+void B_input(packet)
+  struct pkt packet;
+{
+  conn_B_input(0, packet);
+}
+
 void B_init()
 {
-  b_pktnum = 0;
+  conn_B_init(0);
 }
@@ -0,0 +1,159 @@
+#include "checksum.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_CRC32_INSN 1
+#endif
+
+enum checksum_kind checksum_kind = CHECKSUM_SUM;
+
+const char *checksum_name(enum checksum_kind kind) {
+    switch (kind) {
+        case CHECKSUM_SUM: return "sum";
+        case CHECKSUM_INET: return "inet";
+        case CHECKSUM_CRC32C: return "crc32c";
+    }
+    return "unknown";
+}
+
+unsigned int checksum_compute(const void *data, size_t len) {
+    switch (checksum_kind) {
+        case CHECKSUM_SUM: return checksum_sum(data, len);
+        case CHECKSUM_INET: return checksum_inet(data, len);
+        case CHECKSUM_CRC32C: return checksum_crc32c(data, len);
+    }
+    return 0;
+}
+
+unsigned int checksum_sum(const void *data, size_t len) {
+    const signed char *bytes = (const signed char *) data;
+    unsigned int sum = 0;
+    for (size_t i = 0; i < len; i++) sum += bytes[i];
+    return sum;
+}
+
+// Fold a 32-bit sum of 16-bit words down to the one's complement of the 16-bit sum
+static unsigned int inet_fold(uint64_t sum) {
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return (~sum) & 0xffff;
+}
+
+unsigned int checksum_inet_scalar(const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint64_t sum = 0;
+    size_t i = 0;
+    for (; i + 1 < len; i += 2) {
+        uint16_t word;
+        memcpy(&word, bytes + i, 2);
+        sum += word;
+    }
+    if (i < len) sum += bytes[i];
+    return inet_fold(sum);
+}
+
+unsigned int checksum_inet(const void *data, size_t len) {
+#if defined(__SSE2__)
+    const unsigned char *bytes = (const unsigned char *) data;
+    // Widen each 16-byte load to 32-bit lanes, so no lane can overflow
+    // before 2^16 loads
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (bytes + i));
+        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *) lanes, acc);
+    uint64_t sum = (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    // Scalar tail; the one's complement sum doesn't care where it is folded in
+    unsigned int tail = checksum_inet_scalar(bytes + i, len - i);
+    sum += (~tail) & 0xffff;
+    return inet_fold(sum);
+#else
+    return checksum_inet_scalar(data, len);
+#endif
+}
+
+// Reflected CRC32C (Castagnoli) polynomial
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc32c_table[256];
+// Whether the CPU has the crc32 instruction; settled before main, so shard threads only read it
+static int crc32c_hw;
+
+// Fill in the byte-at-a-time lookup table
+static void crc32c_init_table() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t crc = n;
+        for (int k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[n] = crc;
+    }
+}
+
+// Pick the kernel and set up the CRC once at program start, before any thread
+// can checksum a packet
+__attribute__((constructor))
+static void checksum_init() {
+    crc32c_init_table();
+#ifdef HAVE_CRC32_INSN
+    crc32c_hw = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+#endif
+    const char *kind = getenv("CHECKSUM");
+    if (kind == NULL || kind[0] == '\0') return;
+    if (strcmp(kind, "sum") == 0) checksum_kind = CHECKSUM_SUM;
+    else if (strcmp(kind, "inet") == 0) checksum_kind = CHECKSUM_INET;
+    else if (strcmp(kind, "crc32c") == 0) checksum_kind = CHECKSUM_CRC32C;
+    else fprintf(stderr, "unknown CHECKSUM %s (sum, inet or crc32c); using %s\n", kind, checksum_name(checksum_kind));
+}
+
+unsigned int checksum_crc32c_table(const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) crc = crc32c_table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffu;
+}
+
+#ifdef HAVE_CRC32_INSN
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_insn(const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint32_t crc = 0xffffffffu;
+    size_t i = 0;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+#endif
+    for (; i + 4 <= len; i += 4) {
+        uint32_t word;
+        memcpy(&word, bytes + i, 4);
+        crc = _mm_crc32_u32(crc, word);
+    }
+    for (; i < len; i++) crc = _mm_crc32_u8(crc, bytes[i]);
+    return crc ^ 0xffffffffu;
+}
+#endif
+
+int checksum_crc32c_hw() {
+    return crc32c_hw;
+}
+
+unsigned int checksum_crc32c(const void *data, size_t len) {
+#ifdef HAVE_CRC32_INSN
+    if (crc32c_hw) return crc32c_insn(data, len);
+#endif
+    return checksum_crc32c_table(data, len);
+}
@@ -0,0 +1,58 @@
+#ifndef CHECKSUM_H_
+#define CHECKSUM_H_
+
+#include <stddef.h>
+
+/* ******************************************************************
+ Checksum kernels behind pkt_checksum() and pkt_valid().
+
+   CHECKSUM_SUM is the original additive sum of seqnum, acknum and the
+   payload bytes. It misses reordered bytes and any set of errors that
+   cancel out. CHECKSUM_INET is the 16-bit Internet one's complement
+   sum (RFC 1071); it catches every single-bit error and swapped bytes,
+   but still misses reordered 16-bit words and errors that cancel across
+   words. CHECKSUM_CRC32C is the Castagnoli CRC, which catches every
+   burst up to 32 bits and any reordering we are likely to see.
+
+   The one's complement sum uses SSE2 loads where the compiler targets
+   them. The CRC uses the SSE4.2 crc32 instruction when the CPU has it
+   (checked at run time), and a byte-at-a-time table otherwise. Both
+   protocols hash the whole struct pkt with the checksum field zeroed.
+
+   The default is CHECKSUM_SUM, so packets stay readable by a PA2 peer.
+   The CHECKSUM environment variable (sum, inet or crc32c) picks another
+   kernel at startup; both ends of a run share the process, so they
+   always agree.
+**********************************************************************/
+
+enum checksum_kind {
+    CHECKSUM_SUM,
+    CHECKSUM_INET,
+    CHECKSUM_CRC32C
+};
+
+// Algorithm pkt_checksum() uses; both sides of a connection must agree on it.
+// Set from the CHECKSUM environment variable before main.
+extern enum checksum_kind checksum_kind;
+
+// Name of an algorithm, for printing
+const char *checksum_name(enum checksum_kind kind);
+
+// Checksum of len bytes with the selected algorithm (CHECKSUM_SUM sums bytes)
+unsigned int checksum_compute(const void *data, size_t len);
+
+// Plain sum of the bytes, as signed chars
+unsigned int checksum_sum(const void *data, size_t len);
+
+// Internet checksum, vectorized where possible, and its scalar reference
+unsigned int checksum_inet(const void *data, size_t len);
+unsigned int checksum_inet_scalar(const void *data, size_t len);
+
+// CRC32C, with the crc32 instruction where available, and the table version
+unsigned int checksum_crc32c(const void *data, size_t len);
+unsigned int checksum_crc32c_table(const void *data, size_t len);
+
+// Whether checksum_crc32c() runs on the crc32 instruction
+int checksum_crc32c_hw();
+
+#endif
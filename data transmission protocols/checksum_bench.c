@@ -0,0 +1,123 @@
+#include "checksum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* ******************************************************************
+ Microbenchmark for the checksum kernels in checksum.c.
+
+   Times each kernel over a batch of random 32-byte packets (the size of
+   struct pkt), then corrupts packets in a few typical ways and counts
+   how many corruptions each kernel fails to notice.
+
+   Build and run:
+     gcc -O2 -o checksum_bench checksum_bench.c checksum.c
+     ./checksum_bench [packets] [rounds] [trials]
+**********************************************************************/
+
+#define PKTSIZE 32
+
+struct kernel {
+    const char *name;
+    unsigned int (*fn)(const void *data, size_t len);
+};
+
+struct kernel kernels[] = {
+    {"sum", checksum_sum},
+    {"inet scalar", checksum_inet_scalar},
+    {"inet", checksum_inet},
+    {"crc32c table", checksum_crc32c_table},
+    {"crc32c", checksum_crc32c},
+};
+int nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+// Keeps the timed checksums from being optimized away
+volatile unsigned int sink;
+
+double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Corruptions the simulated channel, or a real one, could make
+void swap_bytes(unsigned char *p) {
+    int i = rand() % (PKTSIZE - 1);
+    unsigned char t = p[i];
+    p[i] = p[i+1];
+    p[i+1] = t;
+}
+
+void flip_two_bits(unsigned char *p) {
+    int a = rand() % (PKTSIZE * 8);
+    int b = rand() % (PKTSIZE * 8);
+    while (b == a) b = rand() % (PKTSIZE * 8);
+    p[a/8] ^= 1 << (a%8);
+    p[b/8] ^= 1 << (b%8);
+}
+
+void burst(unsigned char *p) {
+    int start = rand() % (PKTSIZE - 4);
+    for (int i = 0; i < 4; i++) p[start+i] = rand();
+}
+
+struct corruption {
+    const char *name;
+    void (*fn)(unsigned char *p);
+};
+
+struct corruption corruptions[] = {
+    {"adjacent byte swap", swap_bytes},
+    {"two bit flips", flip_two_bits},
+    {"4-byte burst", burst},
+};
+int ncorruptions = sizeof(corruptions) / sizeof(corruptions[0]);
+
+int main(int argc, char **argv) {
+    int npkts = argc > 1 ? atoi(argv[1]) : 4096;
+    int rounds = argc > 2 ? atoi(argv[2]) : 2000;
+    int trials = argc > 3 ? atoi(argv[3]) : 1000000;
+    srand(1);
+
+    unsigned char *pkts = (unsigned char *) malloc((size_t) npkts * PKTSIZE);
+    for (int i = 0; i < npkts * PKTSIZE; i++) pkts[i] = rand();
+
+    printf("crc32 instruction: %s\n\n", checksum_crc32c_hw() ? "yes" : "no");
+    printf("%-14s %10s %10s\n", "kernel", "ns/pkt", "GB/s");
+    for (int k = 0; k < nkernels; k++) {
+        unsigned int total = 0;
+        double start = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < npkts; i++) total += kernels[k].fn(pkts + (size_t) i * PKTSIZE, PKTSIZE);
+        }
+        double ns = (now_ns() - start) / ((double) rounds * npkts);
+        sink = total;
+        printf("%-14s %10.2f %10.2f\n", kernels[k].name, ns, PKTSIZE / ns);
+    }
+
+    printf("\nundetected corruptions out of %d\n%-20s", trials, "");
+    for (int k = 0; k < nkernels; k++) printf(" %14s", kernels[k].name);
+    printf("\n");
+    for (int c = 0; c < ncorruptions; c++) {
+        printf("%-20s", corruptions[c].name);
+        for (int k = 0; k < nkernels; k++) {
+            srand(2 + c);
+            int missed = 0;
+            for (int t = 0; t < trials; t++) {
+                unsigned char p[PKTSIZE];
+                memcpy(p, pkts + (size_t) (t % npkts) * PKTSIZE, PKTSIZE);
+                unsigned int before = kernels[k].fn(p, PKTSIZE);
+                unsigned char orig[PKTSIZE];
+                memcpy(orig, p, PKTSIZE);
+                corruptions[c].fn(p);
+                // Only count corruptions that changed the packet
+                if (memcmp(p, orig, PKTSIZE) != 0 && kernels[k].fn(p, PKTSIZE) == before) missed++;
+            }
+            printf(" %14d", missed);
+        }
+        printf("\n");
+    }
+    free(pkts);
+    return 0;
+}
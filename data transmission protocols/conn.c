@@ -0,0 +1,25 @@
+#include "conn.h"
+#include <stdlib.h>
+#include <string.h>
+
+void conn_table_init(struct conn_table *table, size_t size) {
+    table->conns = NULL;
+    table->capacity = 0;
+    table->size = size;
+    table->count = 0;
+}
+
+void *conn_add(struct conn_table *table, int id) {
+    if (id >= table->capacity) {
+        int capacity = table->capacity > 0 ? table->capacity : 16;
+        while (capacity <= id) capacity *= 2;
+        table->conns = (void **) realloc(table->conns, capacity * sizeof(void *));
+        memset(table->conns + table->capacity, 0, (capacity - table->capacity) * sizeof(void *));
+        table->capacity = capacity;
+    }
+    if (table->conns[id] == NULL) {
+        table->conns[id] = calloc(1, table->size);
+        table->count++;
+    }
+    return table->conns[id];
+}
@@ -0,0 +1,37 @@
+#ifndef CONN_H_
+#define CONN_H_
+
+#include <stddef.h>
+
+/* ******************************************************************
+ Connection table: demultiplexes events to per-connection protocol
+ state by connection ID.
+
+   Each protocol keeps everything it knows about one A-to-B flow in a
+   connection struct and looks it up here from the ID the emulator
+   passes with every event, so one process can carry any number of
+   flows. Lookup is an array index. Adding an ID beyond the end grows
+   the table, so add every connection before sharding them across
+   threads; after that lookups never write, and each connection is only
+   touched by the thread running its shard.
+**********************************************************************/
+
+struct conn_table {
+    void **conns;       // connection state by ID, NULL where there is none
+    int capacity;
+    size_t size;        // bytes of state per connection
+    int count;          // connections added
+};
+
+// Set up an empty table for connection structs of size bytes
+void conn_table_init(struct conn_table *table, size_t size);
+
+// State for connection id, created zeroed if it is new
+void *conn_add(struct conn_table *table, int id);
+
+// State for connection id, or NULL if it was never added
+static inline void *conn_find(struct conn_table *table, int id) {
+    return id >= 0 && id < table->capacity ? table->conns[id] : NULL;
+}
+
+#endif
@@ -0,0 +1,309 @@
+#include "simulator.h"
+#include "conn.h"
+#include "metrics.h"
+#include "packet.h"
+#include "rtt.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* ******************************************************************
+ ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
+
+   This code should be used for PA2, unidirectional data transfer 
+   protocols (from A to B). Network properties:
+   - one way network delay averages five time units (longer if there
+     are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+     or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+     (although some can be lost).
+**********************************************************************/
+
+struct queue_elem {
+    struct pkt pkt;
+    int retries;
+    float queued;   // when layer 5 handed the message over
+    float time_sent;
+};
+
+// Ring buffer of packets indexed by seqnum % capacity. Slots [base, nextsend)
+// are the send window, slots [nextsend, nextseq) are waiting for window space.
+struct sendring {
+    struct queue_elem *slots;
+    int capacity;
+    unsigned int base;
+    unsigned int nextsend;
+    unsigned int nextseq;
+};
+
+// Get the ring slot holding a given seqnum
+struct queue_elem *ring_slot(struct sendring *ring, unsigned int seqnum) {
+  return &ring->slots[seqnum & (ring->capacity - 1)];
+}
+
+// Double the ring's capacity, keeping every slot at seqnum % capacity
+void ring_grow(struct sendring *ring) {
+  struct queue_elem *old = ring->slots;
+  int oldcap = ring->capacity;
+  ring->capacity *= 2;
+  ring->slots = (struct queue_elem *) calloc(ring->capacity, sizeof(struct queue_elem));
+  for (unsigned int seq = ring->base; seq != ring->nextseq; seq++) {
+    *ring_slot(ring, seq) = old[seq & (oldcap - 1)];
+  }
+  free(old);
+}
+
+// Everything one A-to-B connection knows, on both sides
+struct gbn_conn {
+    int id;
+    struct sendring a_ring;
+    int a_timer_running;
+    struct rtt_estimator a_rtt;
+    unsigned int b_expected;
+    struct metrics a_metrics;
+    struct metrics b_metrics;
+};
+
+struct conn_table conns;
+int winsize;
+
+#define RTT 15
+
+// Smallest power of two that holds at least size entries
+int pow2_capacity(int size) {
+  int capacity = 1;
+  while (capacity < size) capacity *= 2;
+  return capacity;
+}
+
+// Start the connection's one timer if it isn't already running
+void start_timer(struct gbn_conn *c) {
+  if (c->a_timer_running) return;
+  conn_starttimer(c->id, 0, rtt_timeout(&c->a_rtt));
+  c->a_timer_running = 1;
+  metrics_gauge(&c->a_metrics, METRIC_TIMERS, 1);
+}
+
+// Stop the connection's one timer if it is running
+void stop_timer(struct gbn_conn *c) {
+  if (!c->a_timer_running) return;
+  conn_stoptimer(c->id, 0);
+  c->a_timer_running = 0;
+  metrics_gauge(&c->a_metrics, METRIC_TIMERS, 0);
+}
+
+// Bring A's queue and window gauges up to date
+void update_gauges(struct gbn_conn *c) {
+  struct sendring *ring = &c->a_ring;
+  metrics_gauge(&c->a_metrics, METRIC_SEND_QUEUE, seq_diff(ring->nextseq, ring->base));
+  metrics_gauge(&c->a_metrics, METRIC_WINDOW, seq_diff(ring->nextsend, ring->base));
+}
+
+// Put the packet in the next ring slot on the wire, and add it to the window
+void send_next(struct gbn_conn *c) {
+  struct sendring *ring = &c->a_ring;
+  struct queue_elem *slot = ring_slot(ring, ring->nextsend);
+  conn_tolayer3(c->id, 0, slot->pkt);
+  metrics_count(&c->a_metrics, METRIC_SENT);
+  slot->time_sent = get_sim_time();
+  ring->nextsend++;
+  start_timer(c);
+}
+
+/********* STUDENTS WRITE THE NEXT SEVEN ROUTINES *********/
+
+/* called from layer 5, passed the data to be sent to other side; the ring
+   grows as needed, so this never refuses a message */
+int conn_A_output(conn, message)
+  int conn;
+  struct msg message;
+{
+  struct gbn_conn *c = (struct gbn_conn *) conn_find(&conns, conn);
+  struct sendring *ring = &c->a_ring;
+  // Add packet for message to the ring
+  if (seq_diff(ring->nextseq, ring->base) == ring->capacity) ring_grow(ring);
+  struct queue_elem *slot = ring_slot(ring, ring->nextseq);
+  make_pkt(&slot->pkt, (int) ring->nextseq, 0, message.data);
+  slot->retries = 0;
+  slot->queued = get_sim_time();
+  ring->nextseq++;
+  // If window isn't full, send it right away
+  if (seq_diff(ring->nextsend, ring->base) < winsize) send_next(c);
+  update_gauges(c);
+  return SEND_OK;
+}
+
+/* called from layer 3, when a packet arrives for layer 4 */
+void conn_A_input(conn, packet)
+  int conn;
+  struct pkt packet;
+{
+  struct gbn_conn *c = (struct gbn_conn *) conn_find(&conns, conn);
+  struct sendring *ring = &c->a_ring;
+  if (!pkt_valid(&packet)) {
+    metrics_count(&c->a_metrics, METRIC_CORRUPTED);
+    return;
+  }
+  metrics_count(&c->a_metrics, METRIC_ACKS);
+  // Cumulative ack: everything before acknum arrived. Ignore old acks and acks
+  // for packets never sent.
+  unsigned int cumulative = packet.acknum;
+  if (seq_diff(cumulative, ring->base) <= 0 || seq_diff(cumulative, ring->nextsend) > 0) {
+    metrics_count(&c->a_metrics, METRIC_DUP_ACKS);
+    return;
+  }
+  // Karn's rule: only time the packet that triggered the ack, if it was sent once
+  unsigned int echoed = packet.seqnum;
+  if (seq_diff(echoed, ring->base) >= 0 && seq_diff(echoed, cumulative) < 0) {
+    struct queue_elem *slot = ring_slot(ring, echoed);
+    if (slot->retries == 0) {
+      rtt_sample(&c->a_rtt, get_sim_time() - slot->time_sent);
+      metrics_observe(&c->a_metrics, METRIC_RTT, get_sim_time() - slot->time_sent);
+    }
+  }
+  for (unsigned int seq = ring->base; seq != cumulative; seq++) {
+    metrics_observe(&c->a_metrics, METRIC_ACK_LATENCY, get_sim_time() - ring_slot(ring, seq)->queued);
+  }
+  // Slide the window, refill it, and restart the timer for what's still in flight
+  ring->base = cumulative;
+  stop_timer(c);
+  while (ring->nextsend != ring->nextseq && seq_diff(ring->nextsend, ring->base) < winsize) {
+    send_next(c);
+  }
+  if (ring->nextsend != ring->base) start_timer(c);
+  update_gauges(c);
+}
+
+/* called when A's timer goes off */
+void conn_A_timerinterrupt(conn)
+  int conn;
+{
+  struct gbn_conn *c = (struct gbn_conn *) conn_find(&conns, conn);
+  struct sendring *ring = &c->a_ring;
+  c->a_timer_running = 0;
+  metrics_gauge(&c->a_metrics, METRIC_TIMERS, 0);
+  rtt_backoff(&c->a_rtt);
+  // Go back N: resend the whole window
+  for (unsigned int seq = ring->base; seq != ring->nextsend; seq++) {
+    struct queue_elem *slot = ring_slot(ring, seq);
+    conn_tolayer3(conn, 0, slot->pkt);
+    metrics_count(&c->a_metrics, METRIC_RETRANSMITTED);
+    slot->retries++;
+    slot->time_sent = get_sim_time();
+  }
+  if (ring->nextsend != ring->base) start_timer(c);
+}  
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void conn_A_init(conn)
+  int conn;
+{
+  winsize = getwinsize();
+  if (conns.size == 0) conn_table_init(&conns, sizeof(struct gbn_conn));
+  struct gbn_conn *c = (struct gbn_conn *) conn_add(&conns, conn);
+  c->id = conn;
+  // Start small so thousands of idle connections stay cheap; the ring grows
+  // when a connection queues more
+  c->a_ring.capacity = pow2_capacity(2 * winsize);
+  c->a_ring.slots = (struct queue_elem *) calloc(c->a_ring.capacity, sizeof(struct queue_elem));
+  c->a_ring.base = 0;
+  c->a_ring.nextsend = 0;
+  c->a_ring.nextseq = 0;
+  c->a_timer_running = 0;
+  rtt_init(&c->a_rtt, RTT + (5*winsize));
+  metrics_init(&c->a_metrics);
+}
+
+/* Note that with simplex transfer from a-to-B, there is no B_output() */
+
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+void conn_B_input(conn, packet)
+  int conn;
+  struct pkt packet;
+{
+  struct gbn_conn *c = (struct gbn_conn *) conn_find(&conns, conn);
+  if (!pkt_valid(&packet)) {
+    metrics_count(&c->b_metrics, METRIC_CORRUPTED);
+    return;
+  }
+  // Deliver only the next packet in order; everything else is dropped
+  if ((unsigned int) packet.seqnum == c->b_expected) {
+    conn_tolayer5(conn, 1, packet.payload);
+    metrics_count(&c->b_metrics, METRIC_DELIVERED);
+    metrics_observe(&c->b_metrics, METRIC_DELIVERY_LATENCY, get_sim_time() - get_sent_time(1, packet.payload));
+    c->b_expected++;
+  }
+  // Ack cumulatively: acknum is the next seqnum B is waiting for, and seqnum
+  // echoes the packet that triggered the ack
+  struct pkt ack;
+  make_pkt(&ack, packet.seqnum, (int) c->b_expected, NULL);
+  conn_tolayer3(conn, 1, ack);
+}
+
+/* the following rouytine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+void conn_B_init(conn)
+  int conn;
+{
+  if (conns.size == 0) conn_table_init(&conns, sizeof(struct gbn_conn));
+  struct gbn_conn *c = (struct gbn_conn *) conn_add(&conns, conn);
+  c->id = conn;
+  c->b_expected = 0;
+  metrics_init(&c->b_metrics);
+}
+
+/* live metrics for one side of a connection */
+struct metrics *conn_metrics(conn, AorB)
+  int conn;
+  int AorB;
+{
+  struct gbn_conn *c = (struct gbn_conn *) conn_find(&conns, conn);
+  return AorB == 0 ? &c->a_metrics : &c->b_metrics;
+}
+
+/* protocol state for the emulator's -v dump; only A has an RTT estimator */
+void conn_print(conn, AorB, out)
+  int conn;
+  int AorB;
+  FILE *out;
+{
+  struct gbn_conn *c = (struct gbn_conn *) conn_find(&conns, conn);
+  if (AorB != 0) return;
+  fprintf(out, "conn %d A rtt ", conn);
+  rtt_print(&c->a_rtt, out);
+}
+
+/* PA2 entry points: a single connection, number 0 */
+void A_output(message)
+  struct msg message;
+{
+  conn_A_output(0, message);
+}
+
+void A_input(packet)
+  struct pkt packet;
+{
+  conn_A_input(0, packet);
+}
+
+void A_timerinterrupt()
+{
+  conn_A_timerinterrupt(0);
+}
+
+void A_init()
+{
+  conn_A_init(0);
+}
+
+void B_input(packet)
+  struct pkt packet;
+{
+  conn_B_input(0, packet);
+}
+
+void B_init()
+{
+  conn_B_init(0);
+}
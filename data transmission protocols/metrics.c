@@ -0,0 +1,159 @@
+#include "metrics.h"
+#include <math.h>
+#include <string.h>
+
+static const char *counter_names[METRIC_COUNTERS] = {
+    "sent", "retransmitted", "corrupted", "delivered", "acks", "dup_acks", "naks"
+};
+
+static const char *histogram_names[METRIC_HISTOGRAMS] = {
+    "rtt", "ack_latency", "delivery_latency"
+};
+
+static const char *gauge_names[METRIC_GAUGES] = {
+    "send_queue", "window", "pool", "timers"
+};
+
+// Upper bound of a histogram bucket
+static float bucket_bound(int bucket) {
+    return ldexpf(METRIC_BUCKET_MIN, bucket);
+}
+
+// Add the time since a gauge last changed at its current value to its area
+static void gauge_advance(struct gauge *g, float now) {
+    g->area += g->value * (double) (now - g->changed);
+    g->changed = now;
+}
+
+void metrics_init(struct metrics *m) {
+    memset(m, 0, sizeof(*m));
+    m->start = get_sim_time();
+    m->sources = 1;
+    for (int i = 0; i < METRIC_GAUGES; i++) m->gauges[i].changed = m->start;
+}
+
+void metrics_observe(struct metrics *m, int histogram, float value) {
+    struct histogram *h = &m->histograms[histogram];
+    // value / METRIC_BUCKET_MIN is in [2^(e-1), 2^e), which is bucket e
+    int e;
+    frexpf(value / (float) METRIC_BUCKET_MIN, &e);
+    int bucket = e < 0 ? 0 : e >= METRIC_BUCKETS ? METRIC_BUCKETS - 1 : e;
+    h->buckets[bucket]++;
+    if (h->count == 0 || value < h->min) h->min = value;
+    if (h->count == 0 || value > h->max) h->max = value;
+    h->count++;
+    h->sum += value;
+}
+
+void metrics_gauge(struct metrics *m, int gauge, int value) {
+    struct gauge *g = &m->gauges[gauge];
+    gauge_advance(g, get_sim_time());
+    g->value = value;
+    if (value > g->max) g->max = value;
+}
+
+void metrics_snapshot(struct metrics *m, struct metrics *out, int reset) {
+    float now = get_sim_time();
+    for (int i = 0; i < METRIC_GAUGES; i++) gauge_advance(&m->gauges[i], now);
+    *out = *m;
+    out->end = now;
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        struct gauge *g = &out->gauges[i];
+        g->mean = now > m->start ? g->area / (now - m->start) : g->value;
+    }
+    if (!reset) return;
+    struct gauge gauges[METRIC_GAUGES];
+    memcpy(gauges, m->gauges, sizeof(gauges));
+    metrics_init(m);
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        m->gauges[i].value = gauges[i].value;
+        m->gauges[i].max = gauges[i].value;
+    }
+}
+
+void metrics_merge(struct metrics *into, struct metrics *from) {
+    if (into->sources == 0 || from->start < into->start) into->start = from->start;
+    if (from->end > into->end) into->end = from->end;
+    into->sources += from->sources;
+    for (int i = 0; i < METRIC_COUNTERS; i++) into->counters[i] += from->counters[i];
+    for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+        struct histogram *a = &into->histograms[i];
+        struct histogram *b = &from->histograms[i];
+        if (b->count == 0) continue;
+        if (a->count == 0 || b->min < a->min) a->min = b->min;
+        if (a->count == 0 || b->max > a->max) a->max = b->max;
+        a->count += b->count;
+        a->sum += b->sum;
+        for (int j = 0; j < METRIC_BUCKETS; j++) a->buckets[j] += b->buckets[j];
+    }
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        struct gauge *a = &into->gauges[i];
+        struct gauge *b = &from->gauges[i];
+        a->value += b->value;
+        if (b->max > a->max) a->max = b->max;
+        a->area += b->area;
+        a->mean += b->mean;
+    }
+}
+
+float metrics_percentile(struct histogram *h, double fraction) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t) (fraction * (h->count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < METRIC_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) return i == METRIC_BUCKETS - 1 ? h->max : bucket_bound(i);
+    }
+    return h->max;
+}
+
+void metrics_print_text(struct metrics *m, FILE *out) {
+    fprintf(out, "interval %.1f %.1f sources %d\n", m->start, m->end, m->sources);
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        fprintf(out, "%s %llu\n", counter_names[i], (unsigned long long) m->counters[i]);
+    }
+    for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+        struct histogram *h = &m->histograms[i];
+        fprintf(out, "%s count %llu mean %.3f min %.3f max %.3f p50 %.3f p90 %.3f p99 %.3f\n", histogram_names[i],
+                (unsigned long long) h->count, h->count > 0 ? h->sum / h->count : 0, h->min, h->max,
+                metrics_percentile(h, 0.5), metrics_percentile(h, 0.9), metrics_percentile(h, 0.99));
+        for (int j = 0; j < METRIC_BUCKETS; j++) {
+            if (h->buckets[j] != 0) {
+                fprintf(out, "%s le %g %llu\n", histogram_names[i], bucket_bound(j), (unsigned long long) h->buckets[j]);
+            }
+        }
+    }
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        struct gauge *g = &m->gauges[i];
+        fprintf(out, "%s value %d max %d mean %.3f\n", gauge_names[i], g->value, g->max, g->mean);
+    }
+}
+
+void metrics_print_json(struct metrics *m, FILE *out) {
+    fprintf(out, "{\"start\":%.3f,\"end\":%.3f,\"sources\":%d,\"counters\":{", m->start, m->end, m->sources);
+    for (int i = 0; i < METRIC_COUNTERS; i++) {
+        fprintf(out, "%s\"%s\":%llu", i > 0 ? "," : "", counter_names[i], (unsigned long long) m->counters[i]);
+    }
+    fprintf(out, "},\"histograms\":{");
+    for (int i = 0; i < METRIC_HISTOGRAMS; i++) {
+        struct histogram *h = &m->histograms[i];
+        fprintf(out, "%s\"%s\":{\"count\":%llu,\"sum\":%.3f,\"min\":%.3f,\"max\":%.3f,\"p50\":%.3f,\"p90\":%.3f,"
+                "\"p99\":%.3f,\"buckets\":[", i > 0 ? "," : "", histogram_names[i], (unsigned long long) h->count,
+                h->sum, h->min, h->max, metrics_percentile(h, 0.5), metrics_percentile(h, 0.9),
+                metrics_percentile(h, 0.99));
+        int first = 1;
+        for (int j = 0; j < METRIC_BUCKETS; j++) {
+            if (h->buckets[j] == 0) continue;
+            fprintf(out, "%s[%g,%llu]", first ? "" : ",", bucket_bound(j), (unsigned long long) h->buckets[j]);
+            first = 0;
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "},\"gauges\":{");
+    for (int i = 0; i < METRIC_GAUGES; i++) {
+        struct gauge *g = &m->gauges[i];
+        fprintf(out, "%s\"%s\":{\"value\":%d,\"max\":%d,\"mean\":%.3f}", i > 0 ? "," : "", gauge_names[i],
+                g->value, g->max, g->mean);
+    }
+    fprintf(out, "}}");
+}
@@ -0,0 +1,120 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "simulator.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/* ******************************************************************
+ Transport metrics: counters, log-bucketed histograms and gauges.
+
+   Each protocol keeps a struct metrics per connection side and updates
+   it on the hot path: a counter is one increment, a histogram sample a
+   frexp and two adds, a gauge a multiply-add of the time at the old
+   value. Nothing is shared between connections, so sharded runs need no
+   locking. metrics_snapshot() copies a side's metrics out, optionally
+   resetting them for the next interval, and metrics_merge() adds
+   snapshots up; the results print as text or as one line of JSON.
+
+   Histogram bucket 0 holds values below METRIC_BUCKET_MIN and every
+   bucket after it covers twice the range of the one before, so 32
+   buckets reach from an eighth of a time unit to about 2^27. A
+   percentile is read off as the upper bound of its bucket, at most a
+   factor of two high.
+
+   A gauge in a snapshot has its last value, the highest value seen in
+   the interval and the time-weighted mean over it. Merging adds the
+   values and means, so they become totals over every side merged, and
+   keeps the highest single maximum.
+**********************************************************************/
+
+enum metric_counter {
+    METRIC_SENT,            // data packets put on the wire for the first time
+    METRIC_RETRANSMITTED,   // data packets sent again, by a timer or ahead of it
+    METRIC_CORRUPTED,       // packets received with a bad checksum
+    METRIC_DELIVERED,       // messages handed to layer 5
+    METRIC_ACKS,            // acks received, on their own or riding on data
+    METRIC_DUP_ACKS,        // of those, acks that acknowledged nothing new
+    METRIC_NAKS,            // negative acks received
+    METRIC_COUNTERS
+};
+
+enum metric_histogram {
+    METRIC_RTT,             // round trip samples fed to the RTT estimator
+    METRIC_ACK_LATENCY,     // from layer 5 handing a message over to the sender seeing it acked
+    METRIC_DELIVERY_LATENCY, // from layer 5 handing a message over to the receiver delivering it
+    METRIC_HISTOGRAMS
+};
+
+enum metric_gauge {
+    METRIC_SEND_QUEUE,      // messages the sender holds, queued or in flight
+    METRIC_WINDOW,          // packets in flight
+    METRIC_POOL,            // pool blocks in use
+    METRIC_TIMERS,          // logical retransmit timers pending
+    METRIC_GAUGES
+};
+
+#define METRIC_BUCKETS 32
+#define METRIC_BUCKET_MIN 0.125
+
+struct histogram {
+    uint64_t count;
+    double sum;
+    float min;
+    float max;
+    uint64_t buckets[METRIC_BUCKETS];
+};
+
+struct gauge {
+    int value;
+    int max;        // highest value since the last reset
+    double area;    // value integrated over time since the last reset
+    float changed;  // sim time value last changed
+    double mean;    // snapshots only: area over the interval
+};
+
+struct metrics {
+    float start;    // sim time of the last reset
+    float end;      // snapshots only: when the snapshot was taken
+    int sources;    // sides merged into a snapshot
+    uint64_t counters[METRIC_COUNTERS];
+    struct histogram histograms[METRIC_HISTOGRAMS];
+    struct gauge gauges[METRIC_GAUGES];
+};
+
+// Start with everything zero, as of the current sim time
+void metrics_init(struct metrics *m);
+
+// Count one event
+static inline void metrics_count(struct metrics *m, int counter) {
+    m->counters[counter]++;
+}
+
+// Count n events
+static inline void metrics_add(struct metrics *m, int counter, int n) {
+    m->counters[counter] += n;
+}
+
+// Add a sample to a histogram
+void metrics_observe(struct metrics *m, int histogram, float value);
+
+// Set a gauge to a new value
+void metrics_gauge(struct metrics *m, int gauge, int value);
+
+// Copy live metrics into out, bringing the gauges up to now; with reset, start
+// a new interval, keeping each gauge's current value
+void metrics_snapshot(struct metrics *m, struct metrics *out, int reset);
+
+// Add one snapshot into another; into must have been zeroed or snapshotted
+void metrics_merge(struct metrics *into, struct metrics *from);
+
+// Upper bound of the bucket holding the given fraction of a histogram's samples
+float metrics_percentile(struct histogram *h, double fraction);
+
+// Write a snapshot as name/value lines
+void metrics_print_text(struct metrics *m, FILE *out);
+
+// Write a snapshot as a single-line JSON object, without a newline
+void metrics_print_json(struct metrics *m, FILE *out);
+
+#endif
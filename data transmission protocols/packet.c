@@ -0,0 +1,47 @@
+#include "packet.h"
+#include "checksum.h"
+#include <string.h>
+
+// XORed into an ack-only packet's checksum. A corrupted packet would have to
+// match the other kind's checksum exactly to be misread.
+#define ACK_MARK 0x5a3c96e1
+
+void make_pkt(struct pkt *packet, int seqnum, int acknum, const char *payload) {
+    packet->seqnum = seqnum;
+    packet->acknum = acknum;
+    if (payload != NULL) memcpy(packet->payload, payload, 20);
+    else memset(packet->payload, 0, 20);
+    packet->checksum = pkt_checksum(packet);
+}
+
+int pkt_checksum(struct pkt *packet) {
+    if (checksum_kind == CHECKSUM_SUM) {
+        unsigned int check = (unsigned int) packet->seqnum + packet->acknum;
+        for (int i=0;i<20;i++) check += packet->payload[i];
+        return (int) check;
+    }
+    // Hash the whole packet with the checksum field zeroed
+    struct pkt copy = *packet;
+    copy.checksum = 0;
+    return (int) checksum_compute(&copy, sizeof(copy));
+}
+
+int pkt_valid(struct pkt *packet) {
+    return pkt_checksum(packet) == packet->checksum;
+}
+
+void make_ack(struct pkt *packet, int seqnum, int acknum, const char *payload) {
+    make_pkt(packet, seqnum, acknum, payload);
+    packet->checksum ^= ACK_MARK;
+}
+
+int pkt_kind(struct pkt *packet) {
+    int check = pkt_checksum(packet);
+    if (check == packet->checksum) return PKT_DATA;
+    if ((check ^ ACK_MARK) == packet->checksum) return PKT_ACK;
+    return PKT_CORRUPT;
+}
+
+int seq_diff(unsigned int a, unsigned int b) {
+    return (int) (a - b);
+}
@@ -0,0 +1,41 @@
+#ifndef PACKET_H_
+#define PACKET_H_
+
+#include "simulator.h"
+
+/* ******************************************************************
+ Packet construction and validation shared by the ABT, GBN and SR
+ protocols, so every protocol puts the same checksum on the wire.
+
+   The checksum covers seqnum, acknum and all 20 payload bytes, using
+   whichever algorithm checksum_kind selects (see checksum.h). The
+   packet struct has no type field, so a protocol that needs to tell
+   pure acks from data (one running in both directions) builds its acks
+   with make_ack, which marks the checksum, and reads packets with
+   pkt_kind. Acks that must stay readable by a PA2 peer are built with
+   make_pkt instead, unmarked.
+**********************************************************************/
+
+#define PKT_CORRUPT -1
+#define PKT_DATA 0
+#define PKT_ACK 1
+
+// Fill in a packet's fields and its checksum. payload may be NULL for an empty payload.
+void make_pkt(struct pkt *packet, int seqnum, int acknum, const char *payload);
+
+// Checksum of a packet's header fields and payload
+int pkt_checksum(struct pkt *packet);
+
+// Whether a packet arrived intact
+int pkt_valid(struct pkt *packet);
+
+// Like make_pkt, for a packet that carries only an ack
+void make_ack(struct pkt *packet, int seqnum, int acknum, const char *payload);
+
+// PKT_DATA or PKT_ACK for an intact packet, PKT_CORRUPT otherwise
+int pkt_kind(struct pkt *packet);
+
+// Signed distance from seqnum b to seqnum a, correct across wraparound
+int seq_diff(unsigned int a, unsigned int b);
+
+#endif
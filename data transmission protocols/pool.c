@@ -0,0 +1,54 @@
+#include "pool.h"
+#include <stdlib.h>
+
+// Allocate another chunk of blocks and push them all on the free list
+void pool_add_chunk(struct pool *pool) {
+    char *blocks = (char *) malloc(pool->size * pool->chunk);
+    for (int i = pool->chunk - 1; i >= 0; i--) {
+        void *block = blocks + i * pool->size;
+        *(void **) block = pool->free;
+        pool->free = block;
+    }
+    pool->capacity += pool->chunk;
+}
+
+void pool_init(struct pool *pool, size_t size, int capacity) {
+    // Every free block has to be able to hold the free list link
+    if (size < sizeof(void *)) size = sizeof(void *);
+    size = (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+    pool->size = size;
+    pool->chunk = capacity > 0 ? capacity : 1;
+    pool->free = NULL;
+    pool->capacity = 0;
+    pool->in_use = 0;
+    pool->high_water = 0;
+    pool->acquires = 0;
+    pool->releases = 0;
+    pool->grows = 0;
+    pool_add_chunk(pool);
+}
+
+void *pool_acquire(struct pool *pool) {
+    if (pool->free == NULL) {
+        pool_add_chunk(pool);
+        pool->grows++;
+    }
+    void *block = pool->free;
+    pool->free = *(void **) block;
+    pool->in_use++;
+    if (pool->in_use > pool->high_water) pool->high_water = pool->in_use;
+    pool->acquires++;
+    return block;
+}
+
+void pool_release(struct pool *pool, void *block) {
+    *(void **) block = pool->free;
+    pool->free = block;
+    pool->in_use--;
+    pool->releases++;
+}
+
+void pool_print(struct pool *pool, FILE *out) {
+    fprintf(out, "in use %d/%d high water %d acquires %ld releases %ld grows %d\n",
+            pool->in_use, pool->capacity, pool->high_water, pool->acquires, pool->releases, pool->grows);
+}
@@ -0,0 +1,42 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* ******************************************************************
+ Fixed-size block pool for packets and queue elements on the
+ per-message path.
+
+   Blocks are carved out of chunks allocated up front and recycled
+   through a free list, so acquire and release are O(1) and never touch
+   the heap once the pool is sized right. If the pool runs dry it adds
+   another chunk of the same size rather than failing; the grows counter
+   shows when that happened, so the initial capacity can be raised.
+**********************************************************************/
+
+struct pool {
+    size_t size;        // bytes per block
+    int chunk;          // blocks added per chunk
+    void *free;         // free list, linked through the blocks themselves
+    int capacity;       // blocks owned by the pool
+    int in_use;         // blocks currently acquired
+    int high_water;     // most blocks ever acquired at once
+    long acquires;
+    long releases;
+    int grows;          // chunks added after the first
+};
+
+// Set up a pool of capacity blocks, each size bytes
+void pool_init(struct pool *pool, size_t size, int capacity);
+
+// Take a block out of the pool
+void *pool_acquire(struct pool *pool);
+
+// Give a block back to the pool
+void pool_release(struct pool *pool, void *block);
+
+// Write the pool's usage counters on one line
+void pool_print(struct pool *pool, FILE *out);
+
+#endif
@@ -0,0 +1,68 @@
+#include "rtt.h"
+
+// Smoothing gains and variance multiplier from RFC 6298
+#define RTT_ALPHA 0.125
+#define RTT_BETA 0.25
+#define RTT_K 4
+// Smallest variance term, so a perfectly steady link still leaves some slack
+#define RTT_GRANULARITY 1.0
+
+// Clamp a timeout into [RTO_MIN, RTO_MAX]
+float rtt_clamp(float rto) {
+    if (rto < RTO_MIN) return RTO_MIN;
+    if (rto > RTO_MAX) return RTO_MAX;
+    return rto;
+}
+
+// Double a timeout once per backoff step, stopping at RTO_MAX
+float rtt_scaled(float rto, int steps) {
+    while (steps > 0 && rto < RTO_MAX) {
+        rto *= 2;
+        steps--;
+    }
+    return rtt_clamp(rto);
+}
+
+void rtt_init(struct rtt_estimator *est, float initial_rto) {
+    est->srtt = 0;
+    est->rttvar = 0;
+    est->rto = rtt_clamp(initial_rto);
+    est->backoff = 0;
+    est->samples = 0;
+}
+
+void rtt_sample(struct rtt_estimator *est, float rtt) {
+    if (est->samples == 0) {
+        est->srtt = rtt;
+        est->rttvar = rtt / 2;
+    }
+    else {
+        float err = rtt - est->srtt;
+        if (err < 0) err = -err;
+        est->rttvar += RTT_BETA * (err - est->rttvar);
+        est->srtt += RTT_ALPHA * (rtt - est->srtt);
+    }
+    est->samples++;
+    // A fresh sample undoes any backoff
+    float var = RTT_K * est->rttvar;
+    if (var < RTT_GRANULARITY) var = RTT_GRANULARITY;
+    est->rto = rtt_clamp(est->srtt + var);
+    est->backoff = 0;
+}
+
+void rtt_backoff(struct rtt_estimator *est) {
+    if (rtt_timeout(est) < RTO_MAX) est->backoff++;
+}
+
+float rtt_timeout(struct rtt_estimator *est) {
+    return rtt_scaled(est->rto, est->backoff);
+}
+
+float rtt_retry_timeout(struct rtt_estimator *est, int retries) {
+    return rtt_scaled(est->rto, retries);
+}
+
+void rtt_print(struct rtt_estimator *est, FILE *out) {
+    fprintf(out, "timeout %.2f rto %.2f srtt %.2f rttvar %.2f backoff %d samples %d\n",
+            rtt_timeout(est), est->rto, est->srtt, est->rttvar, est->backoff, est->samples);
+}
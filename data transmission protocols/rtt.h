@@ -0,0 +1,48 @@
+#ifndef RTT_H_
+#define RTT_H_
+
+#include <stdio.h>
+
+/* ******************************************************************
+ Retransmission timeout estimator shared by the ABT and SR senders.
+
+   Follows Jacobson/Karels (RFC 6298): a smoothed round trip time and
+   its variation give the timeout, every timeout doubles it, and a new
+   valid sample resets it. Callers apply Karn's rule themselves by only
+   sampling packets that were never retransmitted. A sender with one
+   timer backs the estimator off as a whole; a sender multiplexing
+   per-packet timers backs off each packet by its own retry count
+   instead, so independent losses don't compound. All times are in
+   simulator time units, as returned by get_sim_time().
+**********************************************************************/
+
+#define RTO_MIN 2.0
+#define RTO_MAX 1000.0
+
+struct rtt_estimator {
+    float srtt;     // smoothed round trip time
+    float rttvar;   // round trip time variation
+    float rto;      // retransmission timeout before backoff
+    int backoff;    // timeouts since the last valid sample
+    int samples;    // valid samples taken so far
+};
+
+// Start with no samples and the given timeout
+void rtt_init(struct rtt_estimator *est, float initial_rto);
+
+// Feed in the round trip time of a packet that was sent exactly once
+void rtt_sample(struct rtt_estimator *est, float rtt);
+
+// Double the timeout after a retransmission timer went off
+void rtt_backoff(struct rtt_estimator *est);
+
+// Current retransmission timeout, including backoff
+float rtt_timeout(struct rtt_estimator *est);
+
+// Timeout for a packet that has already been retransmitted retries times
+float rtt_retry_timeout(struct rtt_estimator *est, int retries);
+
+// Write the estimator state on one line
+void rtt_print(struct rtt_estimator *est, FILE *out);
+
+#endif
@@ -0,0 +1,46 @@
+#include "sendbuf.h"
+#include <string.h>
+
+// Add the time since the last change at the old depth to the depth integral
+void sendbuf_advance(struct sendbuf *buf) {
+    float now = get_sim_time();
+    buf->stats.depth_time += buf->stats.depth * (double) (now - buf->changed);
+    buf->changed = now;
+}
+
+void sendbuf_init(struct sendbuf *buf, int high, int low) {
+    if (high < 0) high = 0;
+    if (low < 0 || low >= high) low = high / 2;
+    buf->high = high;
+    buf->low = low;
+    buf->blocked = 0;
+    buf->changed = get_sim_time();
+    memset(&buf->stats, 0, sizeof(buf->stats));
+}
+
+int sendbuf_admit(struct sendbuf *buf) {
+    if (buf->high > 0 && buf->stats.depth >= buf->high) {
+        buf->blocked = 1;
+        buf->stats.would_block++;
+        return SEND_WOULDBLOCK;
+    }
+    sendbuf_advance(buf);
+    buf->stats.depth++;
+    if (buf->stats.depth > buf->stats.max_depth) buf->stats.max_depth = buf->stats.depth;
+    buf->stats.accepted++;
+    return SEND_OK;
+}
+
+int sendbuf_release(struct sendbuf *buf, int n) {
+    sendbuf_advance(buf);
+    buf->stats.depth -= n;
+    if (!buf->blocked || buf->stats.depth > buf->low) return 0;
+    buf->blocked = 0;
+    buf->stats.resumes++;
+    return 1;
+}
+
+void sendbuf_stats(struct sendbuf *buf, struct sendstats *stats) {
+    sendbuf_advance(buf);
+    *stats = buf->stats;
+}
@@ -0,0 +1,41 @@
+#ifndef SENDBUF_H_
+#define SENDBUF_H_
+
+#include "simulator.h"
+
+/* ******************************************************************
+ Bounded send buffer accounting, with high and low watermarks.
+
+   A sender counts every message it holds, queued or sent but not yet
+   acknowledged, against its buffer. Once high messages are held it
+   refuses more: the output routine returns SEND_WOULDBLOCK and layer 5
+   has to hold on to the message. When acknowledgements bring the count
+   back down to low, sendbuf_release() says so, and the sender tells
+   layer 5 with conn_sendready(). The gap between the watermarks keeps a
+   producer from waking up for every single free slot. A high watermark
+   of 0 means the buffer is unbounded and output never blocks.
+**********************************************************************/
+
+struct sendbuf {
+    int high;       // messages held before output blocks, 0 for no limit
+    int low;        // a blocked buffer reopens once this few are held
+    int blocked;    // whether output was refused since the buffer last drained to low
+    float changed;  // sim time depth last changed
+    struct sendstats stats;
+};
+
+// Set up an empty buffer with the given watermarks
+void sendbuf_init(struct sendbuf *buf, int high, int low);
+
+// Count one more message in the buffer. Returns SEND_OK, or SEND_WOULDBLOCK
+// if the buffer is full and the message must not be taken.
+int sendbuf_admit(struct sendbuf *buf);
+
+// Count n messages out of the buffer. Returns 1 if the buffer was blocked and
+// has now drained to its low watermark, so layer 5 should be told.
+int sendbuf_release(struct sendbuf *buf, int n);
+
+// Copy out the statistics, with the depth integral brought up to now
+void sendbuf_stats(struct sendbuf *buf, struct sendstats *stats);
+
+#endif
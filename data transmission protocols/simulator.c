@@ -0,0 +1,776 @@
+#include "simulator.h"
+#include "metrics.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* B_timerinterrupt, B_output and the conn_ entry points are optional */
+#pragma weak B_timerinterrupt
+#pragma weak B_output
+#pragma weak conn_A_output
+#pragma weak conn_A_input
+#pragma weak conn_A_timerinterrupt
+#pragma weak conn_A_init
+#pragma weak conn_B_output
+#pragma weak conn_B_input
+#pragma weak conn_B_timerinterrupt
+#pragma weak conn_B_init
+#pragma weak conn_sendstats
+#pragma weak conn_metrics
+#pragma weak conn_print
+
+/* ******************************************************************
+ Discrete-event network emulator.
+
+   Events live in a binary min-heap ordered by time, then by the order
+   they were scheduled, so equal-time events run first-in first-out.
+   Stopping a timer is O(1): every timer event carries its timer's
+   generation, and a stale one is simply skipped when it comes up.
+
+   Layer 5 on side A produces numbered messages (the first four payload
+   bytes hold the message number). Layer 3 may deliver packets out of
+   order (-o), but layer 5 on side B checks that the messages reach it
+   complete, in the order they were sent and exactly once, and records
+   each one's latency from A_output to delivery. With -b, B sends just as many
+   messages to A the same way, for protocols that have B_output.
+
+   A sending side's layer 5 produces one message stream. If the protocol
+   refuses a message with SEND_WOULDBLOCK, layer 5 holds it and stops
+   producing until the protocol calls conn_sendready() for the
+   connection the message was for; then it offers the message again and
+   carries on. Latency counts from when the protocol took the message.
+
+   With -n, messages are dealt round robin to that many connections,
+   each with its own timers and its own path through the network. With
+   -j, the connections are split into shards (connection c goes to
+   shard c % shards), and each shard runs as an independent simulation
+   on its own thread, with its own clock, event list and share of the
+   messages. Offered load is per process: each shard's messages arrive
+   shards times further apart.
+
+   Usage: <protocol> [options]
+     -m N      messages to send (default 1000)
+     -l P      probability a packet is lost (default 0)
+     -c P      probability a packet is corrupted (default 0)
+     -o P      probability a packet may overtake earlier ones (default 0)
+     -d DIST   one way delay: uniform (1 to 10, the default), exp or const
+     -t T      mean time between messages from layer 5 (default 50)
+     -w N      window size returned by getwinsize() (default 10)
+     -q H[:L]  send buffer high and low watermarks returned by
+               getwatermarks() (default 256:128; 0 for no limit)
+     -b        bidirectional: B sends -m messages to A as well
+     -n N      connections (default 1)
+     -j N      shards, each on its own thread (default 1)
+     -s N      random seed (default 1)
+     -T T      stop at this simulated time (default: run to completion)
+     -M FMT    print the protocol's metrics to stdout at the end, as text
+               or json, if it has conn_metrics
+     -I T      with -M, print each shard's metrics every T time units
+               instead, resetting them each time
+     -v        print a line for every emulator warning and, if the
+               protocol has conn_print, each connection side's state
+               (RTT estimator, pools) at the end
+
+   At the end one summary line of key=value pairs goes to stderr.
+   pkts_per_msg is every packet either side sent over every message;
+   retx_ratio is A's packets per A message less one, or in a
+   bidirectional run both sides' packets, acks included, per message
+   less one. blocked_time is the total time producers were held back.
+   If the protocol has conn_sendstats, the summary also has the send
+   buffers' most messages held (q_max), mean messages held per buffer
+   over the run (q_mean), refused messages (would_block), resumes and
+   packets resent ahead of their timers (fast_retx).
+   The exit status is 0 only if every message was delivered correctly.
+
+   Metrics are merged over every connection and side. The end of run
+   dump covers all shards; an interval dump covers one shard, and in
+   JSON is a line of the form {"shard":S,"metrics":{...}}.
+**********************************************************************/
+
+#define FROM_LAYER5 0
+#define FROM_LAYER3 1
+#define TIMER 2
+#define RESUME 3
+#define METRICS 4
+
+#define A 0
+#define B 1
+
+#define DELAY_UNIFORM 0
+#define DELAY_EXP 1
+#define DELAY_CONST 2
+
+struct event {
+    double time;
+    long order;         // tie-break: scheduling order
+    int type;
+    int side;           // entity the event happens at
+    int conn;           // connection the event belongs to
+    int generation;     // timer events: timer's generation when started
+    struct pkt packet;  // layer 3 events: packet in flight
+};
+
+// One independent simulation over connections index, index + nshards, ...
+struct shard {
+    int index;
+    pthread_t thread;
+
+    // Event list: binary min-heap by (time, order)
+    struct event *events;
+    int nevents;
+    int events_capacity;
+    long events_scheduled;
+
+    double sim_time;
+    unsigned long long rng_state;
+
+    int nconns;
+    int nmsgs;              // messages each sending side sends
+    // Per connection and side, indexed by 2*local connection + side
+    int *timer_running;
+    int *timer_generation;
+    double *last_arrival;   // arrival of the last packet sent that way, so FIFO packets queue behind it
+    int *conn_delivered;    // messages delivered to that side
+
+    // Statistics
+    long ntolayer3[2];
+    long nlost;
+    long ncorrupt;
+    long nreordered;
+    long nwarnings;
+    long nprocessed;
+    int generated[2];       // by sending side
+    int delivered;
+    int misdelivered;
+    double *sent_time[2];   // by sending side: when each message reached layer 4
+    int held[2];            // by sending side: message refused and waiting to be offered again, or -1
+    int held_conn[2];       // connection the held message is for
+    double held_since[2];
+    double blocked_time;    // time sending sides spent holding a refused message
+    double *latencies;      // delivery latency of each delivered message, in delivery order
+};
+
+// Configuration
+static int nmsgs = 1000;
+static double lossprob = 0;
+static double corruptprob = 0;
+static double reorderprob = 0;
+static int delaydist = DELAY_UNIFORM;
+static double lambda = 50;
+static int winsize = 10;
+static int high_watermark = 256;
+static int low_watermark = 128;
+static int nconns = 1;
+static int nshards = 1;
+static int bidirectional = 0;
+static double maxtime = -1;
+static int verbose = 0;
+static const char *metrics_format = NULL;
+static double metrics_interval = 0;
+
+// Shard the calling thread is running
+static __thread struct shard *shard;
+
+// Random number in [0, 1), from a 64-bit xorshift generator
+static double jimsrand() {
+    shard->rng_state ^= shard->rng_state << 13;
+    shard->rng_state ^= shard->rng_state >> 7;
+    shard->rng_state ^= shard->rng_state << 17;
+    return (shard->rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void warn(const char *what, int conn, int side) {
+    shard->nwarnings++;
+    if (verbose) fprintf(stderr, "warning at time %.3f: %s (connection %d side %c)\n",
+                         shard->sim_time, what, conn, side == A ? 'A' : 'B');
+}
+
+// Index of a connection and side in the shard's per-connection arrays, or -1
+// if the connection isn't one of this shard's
+static int conn_index(int conn, int side) {
+    if (conn < 0 || conn % nshards != shard->index || conn / nshards >= shard->nconns) return -1;
+    return 2 * (conn / nshards) + side;
+}
+
+// Helpers for the event heap
+static int event_before(struct event *a, struct event *b) {
+    if (a->time != b->time) return a->time < b->time;
+    return a->order < b->order;
+}
+
+static void schedule(struct event *ev) {
+    if (shard->nevents == shard->events_capacity) {
+        shard->events_capacity *= 2;
+        shard->events = (struct event *) realloc(shard->events, shard->events_capacity * sizeof(struct event));
+    }
+    struct event *events = shard->events;
+    ev->order = shard->events_scheduled++;
+    int i = shard->nevents++;
+    while (i > 0 && event_before(ev, &events[(i-1)/2])) {
+        events[i] = events[(i-1)/2];
+        i = (i-1)/2;
+    }
+    events[i] = *ev;
+}
+
+static void next_event(struct event *out) {
+    struct event *events = shard->events;
+    *out = events[0];
+    int n = --shard->nevents;
+    struct event last = events[n];
+    int i = 0;
+    while (2*i+1 < n) {
+        int child = 2*i+1;
+        if (child+1 < n && event_before(&events[child+1], &events[child])) child++;
+        if (!event_before(&events[child], &last)) break;
+        events[i] = events[child];
+        i = child;
+    }
+    events[i] = last;
+}
+
+// One way delay of a packet
+static double delay() {
+    switch (delaydist) {
+        case DELAY_EXP: return 1 + -4.5 * log(1 - jimsrand());
+        case DELAY_CONST: return 5.5;
+    }
+    return 1 + 9 * jimsrand();
+}
+
+// Schedule the next message from layer 5 at a side
+static void schedule_message(int side) {
+    struct event ev;
+    ev.time = shard->sim_time + lambda * nshards * 2 * jimsrand();
+    ev.type = FROM_LAYER5;
+    ev.side = side;
+    ev.conn = shard->index + (shard->generated[side] % shard->nconns) * nshards;
+    schedule(&ev);
+}
+
+/********************* EMULATOR ROUTINES *********************/
+
+void conn_starttimer(int conn, int AorB, float increment) {
+    int i = conn_index(conn, AorB);
+    if (i < 0) {
+        warn("attempt to start a timer for an unknown connection", conn, AorB);
+        return;
+    }
+    if (shard->timer_running[i]) {
+        warn("attempt to start a timer that is already started", conn, AorB);
+        return;
+    }
+    if (increment < 0) {
+        warn("attempt to start a timer with a negative increment", conn, AorB);
+        increment = 0;
+    }
+    struct event ev;
+    ev.time = shard->sim_time + increment;
+    ev.type = TIMER;
+    ev.side = AorB;
+    ev.conn = conn;
+    ev.generation = shard->timer_generation[i];
+    schedule(&ev);
+    shard->timer_running[i] = 1;
+}
+
+void conn_stoptimer(int conn, int AorB) {
+    int i = conn_index(conn, AorB);
+    if (i < 0 || !shard->timer_running[i]) {
+        warn("unable to cancel your timer. It wasn't running", conn, AorB);
+        return;
+    }
+    shard->timer_running[i] = 0;
+    shard->timer_generation[i]++;
+}
+
+void conn_tolayer3(int conn, int AorB, struct pkt packet) {
+    int i = conn_index(conn, AorB);
+    if (i < 0) {
+        warn("packet sent on an unknown connection", conn, AorB);
+        return;
+    }
+    shard->ntolayer3[AorB]++;
+    if (jimsrand() < lossprob) {
+        shard->nlost++;
+        return;
+    }
+    struct event ev;
+    ev.type = FROM_LAYER3;
+    ev.side = 1 - AorB;
+    ev.conn = conn;
+    ev.packet = packet;
+    if (jimsrand() < corruptprob) {
+        shard->ncorrupt++;
+        double x = jimsrand();
+        if (x < .75) ev.packet.payload[(int) (jimsrand() * 20)] ^= (char) (1 + (int) (jimsrand() * 255));
+        else if (x < .875) ev.packet.seqnum = 999999;
+        else ev.packet.acknum = 999999;
+    }
+    // Packets normally stay in order behind the last one sent this way;
+    // a reordered one just takes its own delay
+    if (jimsrand() < reorderprob) {
+        shard->nreordered++;
+        ev.time = shard->sim_time + delay();
+    }
+    else {
+        double start = shard->last_arrival[i] > shard->sim_time ? shard->last_arrival[i] : shard->sim_time;
+        ev.time = start + delay();
+        shard->last_arrival[i] = ev.time;
+    }
+    schedule(&ev);
+}
+
+void conn_sendready(int conn, int AorB) {
+    if (conn_index(conn, AorB) < 0) {
+        warn("send buffer ready on an unknown connection", conn, AorB);
+        return;
+    }
+    // Offer the held message from the event loop, not from inside the protocol
+    if (shard->held[AorB] < 0 || shard->held_conn[AorB] != conn) return;
+    struct event ev;
+    ev.time = shard->sim_time;
+    ev.type = RESUME;
+    ev.side = AorB;
+    ev.conn = conn;
+    schedule(&ev);
+}
+
+// Check a message delivered at index i of the per-connection arrays and record it
+static void deliver(int conn, int AorB, int i, char datasent[20]) {
+    // Messages were dealt round robin, so local connection c carries c, c + nconns, ...
+    int expected = i / 2 + shard->nconns * shard->conn_delivered[i];
+    int n;
+    memcpy(&n, datasent, 4);
+    int ok = n == expected;
+    for (int i = 4; i < 20 && ok; i++) ok = datasent[i] == (char) ('a' + (n + i) % 26);
+    if (!ok) {
+        shard->misdelivered++;
+        if (verbose) fprintf(stderr, "error at time %.3f: connection %d expected message %d, got message %d\n",
+                             shard->sim_time, conn, expected, n);
+        return;
+    }
+    shard->latencies[shard->delivered] = shard->sim_time - shard->sent_time[1 - AorB][n];
+    shard->delivered++;
+    shard->conn_delivered[i]++;
+}
+
+void conn_tolayer5(int conn, int AorB, char datasent[20]) {
+    int i = conn_index(conn, AorB);
+    if ((AorB == A && !bidirectional) || i < 0) {
+        warn("data delivered to layer 5 at A or on an unknown connection", conn, AorB);
+        return;
+    }
+    deliver(conn, AorB, i, datasent);
+}
+
+void conn_tolayer5_batch(int conn, int AorB, char (*datasent)[20], int count) {
+    int i = conn_index(conn, AorB);
+    if ((AorB == A && !bidirectional) || i < 0) {
+        warn("data delivered to layer 5 at A or on an unknown connection", conn, AorB);
+        return;
+    }
+    for (int k = 0; k < count; k++) deliver(conn, AorB, i, datasent[k]);
+}
+
+void starttimer(int AorB, float increment) {
+    conn_starttimer(0, AorB, increment);
+}
+
+void stoptimer(int AorB) {
+    conn_stoptimer(0, AorB);
+}
+
+void tolayer3(int AorB, struct pkt packet) {
+    conn_tolayer3(0, AorB, packet);
+}
+
+void tolayer5(int AorB, char datasent[20]) {
+    conn_tolayer5(0, AorB, datasent);
+}
+
+int getwinsize() {
+    return winsize;
+}
+
+void getwatermarks(int *high, int *low) {
+    *high = high_watermark;
+    *low = low_watermark;
+}
+
+float get_sim_time() {
+    return shard != NULL ? (float) shard->sim_time : 0;
+}
+
+float get_sent_time(int AorB, char datasent[20]) {
+    int n;
+    memcpy(&n, datasent, 4);
+    // Not a message the other side has sent: report it as sent just now
+    if (shard == NULL || (AorB == A && !bidirectional) || n < 0 || n >= shard->generated[1 - AorB]) return get_sim_time();
+    return (float) shard->sent_time[1 - AorB][n];
+}
+
+/********************* DRIVER *********************/
+
+// Offer message n to the protocol at a side. If it is refused, hold it and
+// make no more messages until the protocol has room again.
+static void offer(int side, int conn, int n) {
+    int multi = conn_A_output != NULL;
+    struct msg message;
+    memcpy(message.data, &n, 4);
+    for (int i = 4; i < 20; i++) message.data[i] = 'a' + (n + i) % 26;
+    shard->sent_time[side][n] = shard->sim_time;
+    int status = SEND_OK;
+    if (side == A) {
+        if (multi) status = conn_A_output(conn, message);
+        else A_output(message);
+    }
+    else {
+        if (multi) status = conn_B_output(conn, message);
+        else B_output(message);
+    }
+    if (status == SEND_WOULDBLOCK) {
+        shard->held[side] = n;
+        shard->held_conn[side] = conn;
+        shard->held_since[side] = shard->sim_time;
+        return;
+    }
+    if (shard->generated[side] < shard->nmsgs) schedule_message(side);
+}
+
+// Hand an event to the protocol, through the conn_ entry points if it has them
+static void dispatch(struct event *ev) {
+    int multi = conn_A_output != NULL;
+    if (ev->type == FROM_LAYER5) offer(ev->side, ev->conn, shard->generated[ev->side]++);
+    else if (ev->type == RESUME) {
+        // Several resumes can be scheduled before the first one runs
+        int n = shard->held[ev->side];
+        if (n < 0 || shard->held_conn[ev->side] != ev->conn) return;
+        shard->held[ev->side] = -1;
+        shard->blocked_time += shard->sim_time - shard->held_since[ev->side];
+        offer(ev->side, ev->conn, n);
+    }
+    else if (ev->type == FROM_LAYER3) {
+        if (ev->side == A) {
+            if (multi) conn_A_input(ev->conn, ev->packet);
+            else A_input(ev->packet);
+        }
+        else {
+            if (multi) conn_B_input(ev->conn, ev->packet);
+            else B_input(ev->packet);
+        }
+    }
+    else {
+        // Skip timers that were stopped after this event was scheduled
+        int i = conn_index(ev->conn, ev->side);
+        if (ev->generation != shard->timer_generation[i]) return;
+        shard->timer_running[i] = 0;
+        if (ev->side == A) {
+            if (multi) conn_A_timerinterrupt(ev->conn);
+            else A_timerinterrupt();
+        }
+        else if (multi && conn_B_timerinterrupt) conn_B_timerinterrupt(ev->conn);
+        else if (!multi && B_timerinterrupt) B_timerinterrupt();
+        else warn("timer went off with no B_timerinterrupt", ev->conn, B);
+    }
+}
+
+// Merge the current metrics of every connection side in a shard
+static void shard_metrics(struct shard *s, struct metrics *out, int reset) {
+    memset(out, 0, sizeof(*out));
+    for (int conn = s->index; conn < nconns; conn += nshards) {
+        for (int side = A; side <= B; side++) {
+            struct metrics snapshot;
+            metrics_snapshot(conn_metrics(conn, side), &snapshot, reset);
+            metrics_merge(out, &snapshot);
+        }
+    }
+}
+
+static void print_metrics(struct metrics *m, int index) {
+    int json = strcmp(metrics_format, "json") == 0;
+    flockfile(stdout);
+    if (index >= 0) printf(json ? "{\"shard\":%d,\"metrics\":" : "# shard %d\n", index);
+    if (json) {
+        metrics_print_json(m, stdout);
+        printf(index >= 0 ? "}\n" : "\n");
+    }
+    else metrics_print_text(m, stdout);
+    funlockfile(stdout);
+}
+
+// Dump the shard's metrics for the interval just ended and start the next one
+static void interval_metrics() {
+    struct metrics m;
+    shard_metrics(shard, &m, 1);
+    print_metrics(&m, shard->index);
+}
+
+static void schedule_metrics() {
+    struct event ev;
+    ev.time = shard->sim_time + metrics_interval;
+    ev.type = METRICS;
+    ev.side = A;
+    ev.conn = shard->index;
+    schedule(&ev);
+}
+
+// Run one shard's simulation to completion
+static void *run_shard(void *arg) {
+    shard = (struct shard *) arg;
+    if (shard->nmsgs > 0) {
+        schedule_message(A);
+        if (bidirectional) schedule_message(B);
+    }
+    int total = shard->nmsgs * (bidirectional ? 2 : 1);
+    struct event ev;
+    int intervals = metrics_interval > 0;
+    if (intervals) schedule_metrics();
+    while (shard->nevents > 0 && shard->delivered < total) {
+        next_event(&ev);
+        if (maxtime >= 0 && ev.time > maxtime) break;
+        shard->sim_time = ev.time;
+        if (ev.type == METRICS) {
+            interval_metrics();
+            // Only while something else is still going on
+            if (shard->nevents > 0) schedule_metrics();
+            continue;
+        }
+        shard->nprocessed++;
+        dispatch(&ev);
+    }
+    // The last, partial interval
+    if (intervals) interval_metrics();
+    return NULL;
+}
+
+// Set up shard index with its share of the connections and messages
+static void shard_init(struct shard *s, int index, unsigned long long seed) {
+    memset(s, 0, sizeof(*s));
+    s->index = index;
+    s->nconns = nconns / nshards + (index < nconns % nshards);
+    s->nmsgs = nmsgs / nshards + (index < nmsgs % nshards);
+    s->held[A] = -1;
+    s->held[B] = -1;
+    s->rng_state = 88172645463325252ULL ^ ((seed + index) * 0x9E3779B97F4A7C15ULL);
+    if (s->rng_state == 0) s->rng_state = 1;
+    s->events_capacity = 1024;
+    s->events = (struct event *) malloc(s->events_capacity * sizeof(struct event));
+    s->timer_running = (int *) calloc(2 * s->nconns, sizeof(int));
+    s->timer_generation = (int *) calloc(2 * s->nconns, sizeof(int));
+    s->last_arrival = (double *) calloc(2 * s->nconns, sizeof(double));
+    s->conn_delivered = (int *) calloc(2 * s->nconns, sizeof(int));
+    s->sent_time[A] = (double *) malloc((s->nmsgs > 0 ? s->nmsgs : 1) * sizeof(double));
+    s->sent_time[B] = bidirectional ? (double *) malloc((s->nmsgs > 0 ? s->nmsgs : 1) * sizeof(double)) : NULL;
+    s->latencies = (double *) malloc((s->nmsgs > 0 ? 2 * s->nmsgs : 1) * sizeof(double));
+}
+
+// Free everything shard_init allocated
+static void shard_free(struct shard *s) {
+    free(s->events);
+    free(s->timer_running);
+    free(s->timer_generation);
+    free(s->last_arrival);
+    free(s->conn_delivered);
+    free(s->sent_time[A]);
+    free(s->sent_time[B]);
+    free(s->latencies);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Latency below which the given fraction of delivered messages fall
+static double percentile(double *sorted, int n, double fraction) {
+    if (n == 0) return 0;
+    int i = (int) (fraction * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static double wall_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    unsigned long long seed = 1;
+    while ((opt = getopt(argc, argv, "m:l:c:o:d:t:w:q:bn:j:s:T:M:I:v")) != -1) {
+        switch (opt) {
+            case 'm': nmsgs = atoi(optarg); break;
+            case 'l': lossprob = atof(optarg); break;
+            case 'c': corruptprob = atof(optarg); break;
+            case 'o': reorderprob = atof(optarg); break;
+            case 'd':
+                if (strcmp(optarg, "exp") == 0) delaydist = DELAY_EXP;
+                else if (strcmp(optarg, "const") == 0) delaydist = DELAY_CONST;
+                else delaydist = DELAY_UNIFORM;
+                break;
+            case 't': lambda = atof(optarg); break;
+            case 'w': winsize = atoi(optarg); break;
+            case 'q': {
+                char *rest;
+                high_watermark = (int) strtol(optarg, &rest, 10);
+                low_watermark = *rest == ':' ? atoi(rest + 1) : high_watermark / 2;
+                break;
+            }
+            case 'b': bidirectional = 1; break;
+            case 'n': nconns = atoi(optarg); break;
+            case 'j': nshards = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'T': maxtime = atof(optarg); break;
+            case 'M': metrics_format = optarg; break;
+            case 'I': metrics_interval = atof(optarg); break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-m msgs] [-l loss] [-c corrupt] [-o reorder] [-d uniform|exp|const]"
+                        " [-t interarrival] [-w window] [-q high[:low]] [-b] [-n connections] [-j shards] [-s seed] [-T maxtime]"
+                        " [-M text|json] [-I interval] [-v]\n",
+                        argv[0]);
+                return 2;
+        }
+    }
+    if (nconns < 1) nconns = 1;
+    if (nshards < 1) nshards = 1;
+    if (nshards > nconns) nshards = nconns;
+    int multi = conn_A_output != NULL;
+    if (!multi && nconns > 1) {
+        fprintf(stderr, "%s: this protocol has no conn_ entry points, so it can only run one connection\n", argv[0]);
+        return 2;
+    }
+    if (metrics_format != NULL && (!multi || conn_metrics == NULL)) {
+        fprintf(stderr, "%s: this protocol has no conn_metrics, so it has no metrics to print\n", argv[0]);
+        return 2;
+    }
+    if (metrics_format == NULL) metrics_interval = 0;
+    if (high_watermark < 0) high_watermark = 0;
+    if (low_watermark < 0 || low_watermark >= high_watermark) low_watermark = high_watermark / 2;
+    if (bidirectional && (multi ? conn_B_output == NULL : B_output == NULL)) {
+        fprintf(stderr, "%s: this protocol has no B_output, so it can only send from A to B\n", argv[0]);
+        return 2;
+    }
+
+    struct shard *shards = (struct shard *) malloc(nshards * sizeof(struct shard));
+    for (int i = 0; i < nshards; i++) shard_init(&shards[i], i, seed);
+
+    // Set every connection up before the shards start, so the protocol's
+    // connection table is complete before any thread looks things up in it
+    for (int conn = 0; conn < nconns; conn++) {
+        shard = &shards[conn % nshards];
+        if (multi) {
+            conn_A_init(conn);
+            conn_B_init(conn);
+        }
+        else {
+            A_init();
+            B_init();
+        }
+    }
+    shard = NULL;
+
+    double wall_start = wall_seconds();
+    if (nshards == 1) run_shard(&shards[0]);
+    else {
+        for (int i = 0; i < nshards; i++) pthread_create(&shards[i].thread, NULL, run_shard, &shards[i]);
+        for (int i = 0; i < nshards; i++) pthread_join(shards[i].thread, NULL);
+    }
+    double wall = wall_seconds() - wall_start;
+    if (metrics_format != NULL && metrics_interval <= 0) {
+        struct metrics all, m;
+        memset(&all, 0, sizeof(all));
+        for (int i = 0; i < nshards; i++) {
+            shard = &shards[i];
+            shard_metrics(shard, &m, 0);
+            metrics_merge(&all, &m);
+        }
+        shard = NULL;
+        print_metrics(&all, -1);
+    }
+    fflush(stdout);
+
+    // Add the shards up
+    struct shard total;
+    memset(&total, 0, sizeof(total));
+    total.latencies = (double *) malloc((nmsgs > 0 ? 2 * nmsgs : 1) * sizeof(double));
+    for (int i = 0; i < nshards; i++) {
+        struct shard *s = &shards[i];
+        if (s->sim_time > total.sim_time) total.sim_time = s->sim_time;
+        total.ntolayer3[A] += s->ntolayer3[A];
+        total.ntolayer3[B] += s->ntolayer3[B];
+        total.nlost += s->nlost;
+        total.ncorrupt += s->ncorrupt;
+        total.nreordered += s->nreordered;
+        total.nwarnings += s->nwarnings;
+        total.nprocessed += s->nprocessed;
+        total.generated[A] += s->generated[A];
+        total.generated[B] += s->generated[B];
+        total.misdelivered += s->misdelivered;
+        total.blocked_time += s->blocked_time;
+        memcpy(total.latencies + total.delivered, s->latencies, s->delivered * sizeof(double));
+        total.delivered += s->delivered;
+    }
+
+    qsort(total.latencies, total.delivered, sizeof(double), compare_doubles);
+    double goodput = total.sim_time > 0 ? total.delivered / total.sim_time : 0;
+    int generated = total.generated[A] + total.generated[B];
+    long packets = total.ntolayer3[A] + total.ntolayer3[B];
+    double per_msg = generated > 0 ? (double) packets / generated : 0;
+    double retx = bidirectional ? per_msg - 1
+                  : total.generated[A] > 0 ? (double) total.ntolayer3[A] / total.generated[A] - 1 : 0;
+    int expected = nmsgs * (bidirectional ? 2 : 1);
+    fprintf(stderr, "msgs=%d delivered=%d errors=%d conns=%d shards=%d simtime=%.1f goodput=%.5f a_sent=%ld"
+            " b_sent=%ld pkts_per_msg=%.4f retx_ratio=%.4f lost=%ld corrupted=%ld reordered=%ld lat_p50=%.2f"
+            " lat_p90=%.2f lat_p99=%.2f events=%ld wall=%.3f events_per_sec=%.0f warnings=%ld blocked_time=%.1f",
+            expected, total.delivered, total.misdelivered, nconns, nshards, total.sim_time, goodput,
+            total.ntolayer3[A], total.ntolayer3[B], per_msg, retx, total.nlost, total.ncorrupt, total.nreordered,
+            percentile(total.latencies, total.delivered, 0.5), percentile(total.latencies, total.delivered, 0.9),
+            percentile(total.latencies, total.delivered, 0.99), total.nprocessed, wall,
+            wall > 0 ? total.nprocessed / wall : 0, total.nwarnings, total.blocked_time);
+
+    // Send buffer statistics, read with each connection's shard current so the
+    // protocol sees that shard's clock
+    if (multi && conn_sendstats) {
+        struct sendstats sum, stats;
+        memset(&sum, 0, sizeof(sum));
+        double mean = 0;
+        int buffers = 0;
+        for (int conn = 0; conn < nconns; conn++) {
+            shard = &shards[conn % nshards];
+            for (int side = A; side <= (bidirectional ? B : A); side++) {
+                conn_sendstats(conn, side, &stats);
+                if (stats.max_depth > sum.max_depth) sum.max_depth = stats.max_depth;
+                if (shard->sim_time > 0) mean += stats.depth_time / shard->sim_time;
+                sum.would_block += stats.would_block;
+                sum.resumes += stats.resumes;
+                sum.fast_retransmits += stats.fast_retransmits;
+                buffers++;
+            }
+        }
+        shard = NULL;
+        fprintf(stderr, " q_max=%d q_mean=%.2f would_block=%ld resumes=%ld fast_retx=%ld", sum.max_depth,
+                buffers > 0 ? mean / buffers : 0, sum.would_block, sum.resumes, sum.fast_retransmits);
+    }
+    fprintf(stderr, "\n");
+
+    // Each side's protocol state, one connection after another
+    if (verbose && multi && conn_print) {
+        for (int conn = 0; conn < nconns; conn++) {
+            shard = &shards[conn % nshards];
+            for (int side = A; side <= (bidirectional ? B : A); side++) conn_print(conn, side, stderr);
+        }
+        shard = NULL;
+    }
+
+    for (int i = 0; i < nshards; i++) shard_free(&shards[i]);
+    free(shards);
+    free(total.latencies);
+    return (total.misdelivered == 0 && total.delivered == expected) ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include <stdio.h>
+
+/* ******************************************************************
+ Discrete-event network emulator for the ABT, GBN and SR protocols.
+
+   Stands in for the course's PA2 emulator and keeps its interface.
+   Entity A gets messages from layer 5 and sends them to entity B over a
+   simulated layer 3 that can lose, corrupt, delay and reorder packets.
+   See simulator.c for the command line options.
+
+   The conn_ routines extend the interface to many A-to-B connections in
+   one process. Every event carries a connection ID, the way a real
+   network layer carries the addresses and ports a transport
+   demultiplexes on, and the protocol hands it back with each call. A
+   protocol that defines the conn_ entry points can be run with many
+   connections, sharded across threads; the PA2 routines are connection 0.
+
+   Layer 5 can be pushed back on. conn_A_output and conn_B_output return
+   SEND_WOULDBLOCK when the sender's buffer is full; layer 5 then keeps
+   the message and makes no more until the protocol calls
+   conn_sendready() for that connection and side. getwatermarks() gives
+   the buffer size the run was started with.
+
+   Simulated time is handed out as a float, like the original emulator.
+   Keep runs short enough (about 10^6 time units) that a float still
+   resolves the timer increments the protocols ask for.
+**********************************************************************/
+
+/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
+/* 4 (students' code).  It contains the data (characters) to be delivered */
+/* to layer 5 via the students transport level protocol entities.         */
+struct msg {
+  char data[20];
+};
+
+/* a packet is the data unit passed from layer 4 (students code) to layer */
+/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
+/* students must follow. */
+struct pkt {
+  int seqnum;
+  int acknum;
+  int checksum;
+  char payload[20];
+};
+
+/* what conn_A_output and conn_B_output return */
+#define SEND_OK 0           /* message taken */
+#define SEND_WOULDBLOCK 1   /* buffer full: message not taken, wait for conn_sendready() */
+
+/* sender statistics for one connection and side, from conn_sendstats() */
+struct sendstats {
+  int depth;            /* messages held now: queued or awaiting an ack */
+  int max_depth;        /* most messages held at once */
+  double depth_time;    /* depth integrated over simulated time */
+  long accepted;        /* messages taken from layer 5 */
+  long would_block;     /* messages refused because the buffer was full */
+  long resumes;         /* times a full buffer drained to its low watermark */
+  long fast_retransmits; /* packets resent ahead of their timers */
+};
+
+struct metrics;
+
+/* routines the protocols provide */
+void A_output(struct msg message);
+void A_input(struct pkt packet);
+void A_timerinterrupt();
+void A_init();
+void B_input(struct pkt packet);
+void B_init();
+/* optional: only called if the protocol starts B's timer */
+void B_timerinterrupt();
+/* optional: only called for bidirectional runs, if the protocol has it */
+void B_output(struct msg message);
+
+/* routines the emulator provides */
+void starttimer(int AorB, float increment);
+void stoptimer(int AorB);
+void tolayer3(int AorB, struct pkt packet);
+void tolayer5(int AorB, char datasent[20]);
+int getwinsize();
+void getwatermarks(int *high, int *low);
+float get_sim_time();
+/* when the message about to be delivered at AorB reached layer 4 at the other side */
+float get_sent_time(int AorB, char datasent[20]);
+
+/* multi-connection entry points, optional for a protocol */
+int conn_A_output(int conn, struct msg message);
+void conn_A_input(int conn, struct pkt packet);
+void conn_A_timerinterrupt(int conn);
+void conn_A_init(int conn);
+int conn_B_output(int conn, struct msg message);
+void conn_B_input(int conn, struct pkt packet);
+void conn_B_timerinterrupt(int conn);
+void conn_B_init(int conn);
+/* optional: sender statistics, for the summary */
+void conn_sendstats(int conn, int AorB, struct sendstats *stats);
+/* optional: live metrics for one connection and side (see metrics.h) */
+struct metrics *conn_metrics(int conn, int AorB);
+/* optional: write one side's protocol state (RTT estimator, pools) as lines, for -v */
+void conn_print(int conn, int AorB, FILE *out);
+
+/* multi-connection emulator routines */
+void conn_starttimer(int conn, int AorB, float increment);
+void conn_stoptimer(int conn, int AorB);
+void conn_tolayer3(int conn, int AorB, struct pkt packet);
+void conn_tolayer5(int conn, int AorB, char datasent[20]);
+/* count messages, in order, in one call */
+void conn_tolayer5_batch(int conn, int AorB, char (*datasent)[20], int count);
+void conn_sendready(int conn, int AorB);
+
+#endif
@@ -1,6 +1,14 @@
-#include "../include/simulator.h"
+#include "simulator.h"
+#include "conn.h"
+#include "metrics.h"
+#include "packet.h"
+#include "pool.h"
+#include "rtt.h"
+#include "sendbuf.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* ******************************************************************
  ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
@@ -18,235 +26,864 @@
 struct queue_elem {
     struct pkt *pkt;
     int status;
+    int retries;
+    int fast;           // fast retransmitted and not timed out since, so not fast retransmitted again
+    int later_acks;     // packets sent after this one that were acked before it
+    float queued;       // when layer 5 handed the message over
     float time_sent;
-    struct queue_elem *next;
+    float deadline;
+    int timer_index;
 };
 
-struct pktqueue {
-    struct queue_elem *front;
-    struct queue_elem *back;
+// Ring buffer of packets indexed by seqnum % capacity. Slots [base, nextsend)
+// are the send window, slots [nextsend, nextseq) are waiting for window space.
+// Seqnums are unsigned counters that wrap around, so always compare them with seq_diff.
+struct sendring {
+    struct queue_elem *slots;
+    int capacity;
+    unsigned int base;
+    unsigned int nextsend;
+    unsigned int nextseq;
+};
+
+// Receive window: payloads of packets that arrived out of order, copied into a
+// contiguous arena at seqnum % capacity until they can be delivered in order
+struct recvwindow {
+    char (*payloads)[20];
+    unsigned char *present; // whether each arena slot holds a payload
+    int capacity;
     int size;
+    unsigned int expected;  // next seqnum to deliver to layer 5
 };
 
-void queue(struct pktqueue *queue, struct pkt* packet) {
-  struct queue_elem *new_elem = (struct queue_elem *) malloc(sizeof(struct queue_elem));
-  new_elem->next = NULL;
-  new_elem->pkt = packet;
-  new_elem->status = 0;
-  new_elem->time_sent = get_sim_time();
-  queue->size++;
-  if (queue->back == NULL) {
-    if (queue->front == NULL) {
-      queue->front = new_elem;
-      return;
-    }
-    queue->front->next = new_elem;
-  }
-  else queue->back->next = new_elem;
-  queue->back = new_elem;
-}
-
-// Get packet from front of queue
-struct pkt *dequeue(struct pktqueue *queue) {
-    if (queue->front == NULL) return NULL;
-    struct queue_elem *output_elem = queue->front;
-    queue->front = queue->front->next;
-    if (queue->front == queue->back) queue->back = NULL;
-    struct pkt *output = output_elem->pkt;
-    free(output_elem);
-    queue->size--;
-    return output;
-}
-
-// Given a current timer element, get the next element that needs timing
-struct queue_elem *next_timer(struct pktqueue *queue, struct queue_elem *curr) {
-  if (queue->size == 0) return NULL;
-  struct queue_elem *iter = curr->next;
-  if (iter == NULL) return curr;
-  while (iter != curr) {
-    if (iter->status == 0) return iter;
-    if (iter->next == NULL) iter = queue->front;
-    else iter = iter->next;
-  }
-  return curr;
-}
-
-struct pktqueue *a_queue;
-struct pktqueue *window;
-struct queue_elem *current_timer;
-int next_seqnum;
-struct pkt **b_buffer;
-int b_acks;
-int b_nextstore;
+// Min-heap of per-packet retransmit deadlines, multiplexed onto a side's one hardware
+// timer. Entries are seqnums into ring; each slot remembers its own heap index.
+struct timerheap {
+    struct sendring *ring;
+    unsigned int *seqs;
+    int size;
+    int running;    // whether the hardware timer is armed
+    float armed;    // sim time the hardware timer will go off
+};
+
+// One end of a connection. Either end can send and receive: the sending half
+// owns the ring, timers and RTT estimate, the receiving half the receive window
+// and the ack that is owed for it.
+struct sr_side {
+    struct sendring ring;
+    struct timerheap timers;
+    struct rtt_estimator rtt;
+    struct pool pool;
+    float cwnd;             // congestion window, in packets
+    float ssthresh;         // slow start threshold, in packets
+    unsigned int recover;   // timeouts below this seqnum belong to a loss already reacted to
+    int cwnd_traced;        // whole packets of cwnd last traced
+    long fast_retransmits;
+    int reordering;         // later acks that pass a packet before it counts as lost
+    struct metrics metrics;
+    struct sendbuf sendbuf; // counts every packet in the ring, sent or waiting
+    struct recvwindow window;
+    unsigned int acks;      // per-packet acks sent
+    int ack_pending;        // in-order data arrived and hasn't been acked yet
+    float ack_deadline;     // when a pending ack goes out on its own
+    unsigned int ack_echo;  // seqnum the pending ack will echo
+};
+
+// Everything one connection knows, on both sides: side[0] is A, side[1] is B
+struct sr_conn {
+    int id;
+    struct sr_side side[2];
+};
+
+struct conn_table conns;
 int winsize;
 
-#define BUFFERSIZE 1000
+// 1: the receiver sends selective acks covering the whole receive window; 0: it acks
+// each packet on its own, echoing its payload. The sender understands whichever is set here.
+// Per-packet acks keep PA2's format, with an unmarked checksum, so they can't be told
+// apart from data: in that mode only A sends data, as in PA2.
+int sack_acks = 1;
+
+// How long an in-order packet's ack may wait for data going the other way to ride
+// on, in simulator time units: about one average path delay, so an ack rarely
+// waits longer than the other side's data takes to come back. 0 acks every
+// packet at once. A side that has never had data to send acks at once too, so a
+// one-way run's RTT samples aren't padded by the wait. The SR_ACK_DELAY
+// environment variable overrides it.
+float ack_delay = 10.0;
+
+// 1: the send window is a congestion window that starts small, grows with acks by
+// slow start and then additive increase, and is cut on timeouts, never exceeding
+// getwinsize(); 0: the window is always getwinsize(), as in PA2. Off unless the
+// SR_CC environment variable turns it on, to compare the two.
+int congestion_control = 0;
+
+// Resend a packet once this many packets sent after it are acked, without waiting
+// for its timer; 0 leaves every resend to the timers. The SR_FAST_RETRANSMIT
+// environment variable overrides it.
+int fast_retransmit_acks = 3;
+
+// 1: each run of messages that comes into order goes up to layer 5 in one call,
+// straight from the arena; 0: one tolayer5 call per message, like the PA2
+// emulator expects. The SR_BATCH_DELIVERY environment variable overrides it.
+int batch_delivery = 1;
+
 #define RTT 15
+#define TIMER_SLACK 0.01
+#define SACK_BITS 160
+#define INITIAL_CWND 2
 
+// Get the ring slot holding a given seqnum
+struct queue_elem *ring_slot(struct sendring *ring, unsigned int seqnum) {
+  return &ring->slots[seqnum & (ring->capacity - 1)];
+}
 
+// Double the ring's capacity, keeping every slot at seqnum % capacity
+void ring_grow(struct sendring *ring) {
+  struct queue_elem *old = ring->slots;
+  int oldcap = ring->capacity;
+  ring->capacity *= 2;
+  ring->slots = (struct queue_elem *) calloc(ring->capacity, sizeof(struct queue_elem));
+  for (unsigned int seq = ring->base; seq != ring->nextseq; seq++) {
+    *ring_slot(ring, seq) = old[seq & (oldcap - 1)];
+  }
+  free(old);
+}
 
-/********* STUDENTS WRITE THE NEXT SEVEN ROUTINES *********/
+// Add packet to the back of the ring, giving it the next seqnum
+void ring_push(struct sendring *ring, struct pkt *packet) {
+  if (seq_diff(ring->nextseq, ring->base) == ring->capacity) ring_grow(ring);
+  struct queue_elem *slot = ring_slot(ring, ring->nextseq);
+  slot->pkt = packet;
+  slot->status = 0;
+  slot->retries = 0;
+  slot->fast = 0;
+  slot->later_acks = 0;
+  slot->queued = get_sim_time();
+  slot->time_sent = slot->queued;
+  slot->timer_index = -1;
+  ring->nextseq++;
+}
 
-/* called from layer 5, passed the data to be sent to other side */
-void A_output(message)
-  struct msg message;
-{
-  printf("A got message: %.20s\n", message.data);
-  fflush(NULL);
+// Check whether a seqnum is currently in the send window
+int in_window(struct sendring *ring, unsigned int seqnum) {
+  return seq_diff(seqnum, ring->base) >= 0 && seq_diff(seqnum, ring->nextsend) < 0;
+}
+
+// Smallest power of two that holds at least size entries
+int pow2_capacity(int size) {
+  int capacity = 1;
+  while (capacity < size) capacity *= 2;
+  return capacity;
+}
+
+// Deadline of the timer at a given heap index
+float heap_deadline(struct timerheap *heap, int i) {
+  return ring_slot(heap->ring, heap->seqs[i])->deadline;
+}
+
+// Put a seqnum at a heap index and record the index in its slot
+void heap_place(struct timerheap *heap, int i, unsigned int seqnum) {
+  heap->seqs[i] = seqnum;
+  ring_slot(heap->ring, seqnum)->timer_index = i;
+}
+
+// Move the entry at index i up or down until the heap is ordered again
+void heap_fix(struct timerheap *heap, int i) {
+  unsigned int seqnum = heap->seqs[i];
+  float deadline = ring_slot(heap->ring, seqnum)->deadline;
+  while (i > 0 && heap_deadline(heap, (i-1)/2) > deadline) {
+    heap_place(heap, i, heap->seqs[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  while (2*i+1 < heap->size) {
+    int child = 2*i+1;
+    if (child+1 < heap->size && heap_deadline(heap, child+1) < heap_deadline(heap, child)) child++;
+    if (heap_deadline(heap, child) >= deadline) break;
+    heap_place(heap, i, heap->seqs[child]);
+    i = child;
+  }
+  heap_place(heap, i, seqnum);
+}
+
+// Start or restart the logical timer for a packet
+void timer_arm(struct timerheap *heap, unsigned int seqnum, float deadline) {
+  struct queue_elem *slot = ring_slot(heap->ring, seqnum);
+  slot->deadline = deadline;
+  if (slot->timer_index == -1) {
+    heap->size++;
+    heap_place(heap, heap->size-1, seqnum);
+  }
+  heap_fix(heap, slot->timer_index);
+}
+
+// Stop the logical timer for a packet, if it has one
+void timer_cancel(struct timerheap *heap, unsigned int seqnum) {
+  struct queue_elem *slot = ring_slot(heap->ring, seqnum);
+  int i = slot->timer_index;
+  if (i == -1) return;
+  slot->timer_index = -1;
+  heap->size--;
+  if (i == heap->size) return;
+  heap_place(heap, i, heap->seqs[heap->size]);
+  heap_fix(heap, i);
+}
+
+// Point a side's hardware timer at its earliest deadline, retransmit or delayed ack.
+// A timer that is armed earlier than needed is left alone; it just wakes the timer
+// interrupt up with nothing to do.
+void timer_sync(struct sr_conn *c, int side) {
+  struct sr_side *s = &c->side[side];
+  struct timerheap *heap = &s->timers;
+  metrics_gauge(&s->metrics, METRIC_TIMERS, heap->size);
+  if (heap->size == 0 && !s->ack_pending) {
+    if (heap->running) conn_stoptimer(c->id, side);
+    heap->running = 0;
+    return;
+  }
+  float earliest = heap->size != 0 ? heap_deadline(heap, 0) : s->ack_deadline;
+  if (s->ack_pending && s->ack_deadline < earliest) earliest = s->ack_deadline;
+  if (heap->running && heap->armed <= earliest + TIMER_SLACK) return;
+  if (heap->running) conn_stoptimer(c->id, side);
+  float delay = earliest - get_sim_time();
+  if (delay < TIMER_SLACK) delay = TIMER_SLACK;
+  conn_starttimer(c->id, side, delay);
+  heap->armed = get_sim_time() + delay;
+  heap->running = 1;
+}
+
+// Put a data packet on the wire with the side's current cumulative ack riding in
+// its acknum, which settles any ack the side owes
+void send_data(struct sr_conn *c, int side, struct pkt *packet) {
+  struct sr_side *s = &c->side[side];
+  if ((unsigned int) packet->acknum != s->window.expected) {
+    packet->acknum = (int) s->window.expected;
+    packet->checksum = pkt_checksum(packet);
+  }
+  s->ack_pending = 0;
+  conn_tolayer3(c->id, side, *packet);
+}
+
+// Packets a side may have in flight
+int send_limit(struct sr_side *s) {
+  return congestion_control ? (int) s->cwnd : winsize;
+}
+
+// A newly acknowledged packet opens the congestion window: by one packet per ack in
+// slow start, by about one packet per window of acks after that
+void cwnd_ack(struct sr_side *s) {
+  if (s->cwnd < s->ssthresh) s->cwnd += 1;
+  else s->cwnd += 1 / s->cwnd;
+  if (s->cwnd > winsize) s->cwnd = winsize;
+}
+
+// A packet was lost: halve the threshold, and start over in slow start after a
+// timeout or carry on from the threshold after a fast retransmit. Packets already
+// in flight when that happens were sent into the same congestion, so their losses
+// don't cut the window again.
+void cwnd_loss(struct sr_side *s, unsigned int seqnum, int timeout) {
+  if (seq_diff(seqnum, s->recover) < 0) return;
+  s->ssthresh = seq_diff(s->ring.nextsend, s->ring.base) / 2;
+  if (s->ssthresh < 2) s->ssthresh = 2;
+  s->cwnd = timeout ? 1 : s->ssthresh;
+  s->recover = s->ring.nextsend;
+}
+
+// Trace the congestion window whenever it gains or loses a whole packet
+void trace_cwnd(struct sr_conn *c, int side) {
+  struct sr_side *s = &c->side[side];
+  if (!congestion_control || (int) s->cwnd == s->cwnd_traced) return;
+  s->cwnd_traced = (int) s->cwnd;
+  TRACE_EVENT(TRACE_WINDOW, c->id, side, (unsigned int) s->ssthresh, s->cwnd_traced);
+  TRACE_LOG(TRACE_INFO, "%c%d congestion window %d, threshold %.0f\n", 'A' + side, c->id, s->cwnd_traced, s->ssthresh);
+}
+
+// Put the packet in the next ring slot on the wire, and add it to the window
+void send_next(struct sr_conn *c, int side) {
+  struct sr_side *s = &c->side[side];
+  struct sendring *ring = &s->ring;
+  struct queue_elem *slot = ring_slot(ring, ring->nextsend);
+  send_data(c, side, slot->pkt);
+  slot->time_sent = get_sim_time();
+  timer_arm(&s->timers, ring->nextsend, slot->time_sent + rtt_timeout(&s->rtt));
+  ring->nextsend++;
+  metrics_count(&s->metrics, METRIC_SENT);
+  metrics_gauge(&s->metrics, METRIC_WINDOW, seq_diff(ring->nextsend, ring->base));
+  TRACE_EVENT(TRACE_SEND, c->id, side, ring->nextsend - 1, seq_diff(ring->nextsend, ring->base));
+}
+
+// Mark a window packet as acknowledged and stop its timer. Only a packet that
+// was sent once is timed (Karn's rule), and only if sample is set. Returns 0 if
+// it was already acknowledged.
+int ack_slot(struct sr_side *s, unsigned int seqnum, int sample) {
+  struct queue_elem *slot = ring_slot(&s->ring, seqnum);
+  if (slot->status == 1) return 0;
+  if (sample && slot->retries == 0 && !slot->fast) {
+    rtt_sample(&s->rtt, get_sim_time() - slot->time_sent);
+    metrics_observe(&s->metrics, METRIC_RTT, get_sim_time() - slot->time_sent);
+  }
+  metrics_observe(&s->metrics, METRIC_ACK_LATENCY, get_sim_time() - slot->queued);
+  // Passed by later acks but not lost after all: the network reorders that far,
+  // so wait for more later acks before calling a packet lost
+  if (slot->retries == 0 && !slot->fast && slot->later_acks >= s->reordering) {
+    s->reordering = slot->later_acks + 1 < winsize ? slot->later_acks + 1 : winsize;
+  }
+  slot->status = 1;
+  slot->fast = 0;
+  cwnd_ack(s);
+  timer_cancel(&s->timers, seqnum);
+  return 1;
+}
+
+// Resend a packet now, ahead of its timer. It wasn't a timeout, so the timer
+// isn't backed off, but the packet is no longer timed. Packets sent after the
+// resend can still arrive before it when the network reorders, so a packet is
+// only resent this way once, until its timer goes off.
+void fast_retransmit(struct sr_conn *c, int side, unsigned int seqnum) {
+  struct sr_side *s = &c->side[side];
+  struct queue_elem *slot = ring_slot(&s->ring, seqnum);
+  TRACE_EVENT(TRACE_FAST, c->id, side, seqnum, slot->later_acks);
+  if (congestion_control) cwnd_loss(s, seqnum, 0);
+  send_data(c, side, slot->pkt);
+  metrics_count(&s->metrics, METRIC_RETRANSMITTED);
+  slot->fast = 1;
+  slot->later_acks = 0;
+  slot->time_sent = get_sim_time();
+  timer_arm(&s->timers, seqnum, slot->time_sent + rtt_retry_timeout(&s->rtt, slot->retries));
+  s->fast_retransmits++;
+}
+
+// Whether a packet has been out for most of its own timeout. A reordered packet
+// can pass a whole queue of earlier ones, so later acks alone don't mean a loss
+int overdue(struct sr_side *s, struct queue_elem *slot) {
+  return get_sim_time() - slot->time_sent > rtt_retry_timeout(&s->rtt, slot->retries) * 0.75;
+}
+
+// Packets acked ahead of the window front by one ack: in one pass over [from,
+// from + span), count them against every packet still unacked below them that was
+// sent no later than the newest of them, and resend any that has been passed by
+// the side's reordering threshold of such packets and is overdue. Bit i of fresh
+// marks from+i as one of the count newly acked packets; with fresh NULL they all
+// lie at or past the end.
+void later_acks(struct sr_conn *c, int side, unsigned int from, int span, const char *fresh, int count, float newest) {
+  struct sendring *ring = &c->side[side].ring;
+  int above = count;
+  // A stale ack can start below the window, whose slots now hold newer packets
+  int start = seq_diff(ring->base, from) > 0 ? seq_diff(ring->base, from) : 0;
+  for (int i = start; i < span; i++) {
+    if (fresh != NULL && (fresh[i/8] & (1 << (i%8)))) {
+      above--;
+      continue;
+    }
+    if (!in_window(ring, from + i)) continue;
+    struct queue_elem *slot = ring_slot(ring, from + i);
+    if (slot->status == 1 || slot->fast || slot->time_sent > newest) continue;
+    slot->later_acks += above;
+    if (slot->later_acks >= c->side[side].reordering && overdue(&c->side[side], slot)) fast_retransmit(c, side, from + i);
+  }
+}
+
+// Everything before cumulative arrived; time the packet echoed, if it is one of them.
+// Returns how many packets that newly acknowledged, or -1 for an ack of packets never
+// sent, which is ignored.
+int ack_cumulative(struct sr_side *s, unsigned int cumulative, unsigned int echoed) {
+  struct sendring *ring = &s->ring;
+  if (seq_diff(cumulative, ring->nextsend) > 0) return -1;
+  int acked = 0;
+  for (unsigned int seq = ring->base; seq_diff(seq, cumulative) < 0; seq++) {
+    acked += ack_slot(s, seq, seq == echoed);
+  }
+  return acked;
+}
+
+// Send waiting packets while the window has room for them
+void fill_window(struct sr_conn *c, int side) {
+  struct sendring *ring = &c->side[side].ring;
+  while (ring->nextsend != ring->nextseq && seq_diff(ring->nextsend, ring->base) < send_limit(&c->side[side])) {
+    send_next(c, side);
+  }
+}
+
+// Slide the send window past every acknowledged packet at its front, sending
+// whatever was waiting for the space, then retarget the timer
+void slide_window(struct sr_conn *c, int side) {
+  struct sr_side *s = &c->side[side];
+  struct sendring *ring = &s->ring;
+  unsigned int base = ring->base;
+  // While window front is a received packet:
+  while (ring->nextsend != ring->base && ring_slot(ring, ring->base)->status == 1) {
+    struct queue_elem *front = ring_slot(ring, ring->base);
+    TRACE_LOG(TRACE_DEBUG, "\tWindow front:\n\t\tMessage: %.20s\n\t\tStatus: %d\n", front->pkt->payload, front->status);
+    // remove front from window
+    pool_release(&s->pool, front->pkt);
+    front->pkt = NULL;
+    ring->base++;
+    TRACE_LOG(TRACE_DEBUG, "\tqueue size: %d, window size: %d\n", seq_diff(ring->nextseq, ring->nextsend), seq_diff(ring->nextsend, ring->base));
+  }
+  // send next packets and add them to the window
+  fill_window(c, side);
+  trace_cwnd(c, side);
+  if (ring->base != base) {
+    if (sendbuf_release(&s->sendbuf, seq_diff(ring->base, base))) conn_sendready(c->id, side);
+    metrics_gauge(&s->metrics, METRIC_SEND_QUEUE, s->sendbuf.stats.depth);
+    metrics_gauge(&s->metrics, METRIC_WINDOW, seq_diff(ring->nextsend, ring->base));
+    metrics_gauge(&s->metrics, METRIC_POOL, s->pool.in_use);
+  }
+  // Hardware timer now follows the earliest remaining deadline
+  timer_sync(c, side);
+}
+
+// Get the receive window arena index for a seqnum
+int recv_slot(struct recvwindow *window, unsigned int seqnum) {
+  return seqnum & (window->capacity - 1);
+}
+
+// Per-packet ack: echoes the packet's seqnum and payload back to the sender, in
+// PA2's format, without the ack mark
+void send_ack(struct sr_conn *c, int side, struct pkt *packet) {
+  struct sr_side *s = &c->side[side];
+  struct pkt ack;
+  make_pkt(&ack, packet->seqnum, (int) s->acks, packet->payload);
+  s->acks++;
+  conn_tolayer3(c->id, side, ack);
+}
+
+// Selective ack: acknum is the next seqnum the side is waiting for, so everything
+// before it arrived, and bit i of the payload means acknum+1+i is buffered out of
+// order. seqnum echoes the packet that triggered the ack, so the sender can time it.
+void send_sack(struct sr_conn *c, int side, unsigned int seqnum) {
+  struct sr_side *s = &c->side[side];
+  struct recvwindow *window = &s->window;
+  char bitmap[20] = {0};
+  int span = winsize - 1;
+  if (span > SACK_BITS) span = SACK_BITS;
+  int found = 0;
+  for (int i = 0; i < span && found < window->size; i++) {
+    if (window->present[recv_slot(window, window->expected + 1 + i)]) {
+      bitmap[i/8] |= 1 << (i%8);
+      found++;
+    }
+  }
+  struct pkt ack;
+  make_ack(&ack, (int) seqnum, (int) window->expected, bitmap);
+  s->ack_pending = 0;
+  conn_tolayer3(c->id, side, ack);
+}
+
+// Owe an ack for a packet that just arrived. Anything out of order, or leaving a
+// gap, is acked at once so the sender learns what's missing. An in-order packet's
+// ack waits up to ack_delay for outgoing data to ride on, and later in-order
+// packets join the same wait, but only on a side that sends data at all.
+void schedule_ack(struct sr_conn *c, int side, struct pkt *packet, int offset) {
+  struct sr_side *s = &c->side[side];
+  if (!sack_acks) send_ack(c, side, packet);
+  else if (ack_delay <= 0 || offset != 0 || s->window.size != 0 || s->ring.nextseq == 0) {
+    send_sack(c, side, packet->seqnum);
+  }
+  else if (!s->ack_pending) {
+    s->ack_pending = 1;
+    s->ack_deadline = get_sim_time() + ack_delay;
+    s->ack_echo = packet->seqnum;
+    timer_sync(c, side);
+  }
+}
+
+// Hand count messages to layer 5, in one call or, in compatibility mode, one at a time
+void deliver(struct sr_conn *c, int side, char (*payloads)[20], int count) {
+  for (int i = 0; i < count; i++) {
+    metrics_observe(&c->side[side].metrics, METRIC_DELIVERY_LATENCY, get_sim_time() - get_sent_time(side, payloads[i]));
+  }
+  if (batch_delivery) conn_tolayer5_batch(c->id, side, payloads, count);
+  else {
+    for (int i = 0; i < count; i++) conn_tolayer5(c->id, side, payloads[i]);
+  }
+}
+
+// Deliver the run of buffered messages starting at the next expected seqnum, in at
+// most two batches since the run can wrap around the end of the arena
+void deliver_run(struct sr_conn *c, int side) {
+  struct sr_side *s = &c->side[side];
+  struct recvwindow *window = &s->window;
+  int first = recv_slot(window, window->expected);
+  int count = 0;
+  while (count < window->size && window->present[(first + count) & (window->capacity - 1)]) {
+    window->present[(first + count) & (window->capacity - 1)] = 0;
+    count++;
+  }
+  int tail = window->capacity - first;
+  if (count <= tail) deliver(c, side, &window->payloads[first], count);
+  else {
+    deliver(c, side, &window->payloads[first], tail);
+    deliver(c, side, &window->payloads[0], count - tail);
+  }
+  TRACE_EVENT(TRACE_DELIVER, c->id, side, window->expected, count);
+  metrics_add(&s->metrics, METRIC_DELIVERED, count);
+  window->size -= count;
+  window->expected += count;
+}
+
+// Take in a data packet: an in-order one with nothing buffered goes straight up
+// to layer 5; otherwise buffer it if it is new and inside the receive window, and
+// deliver whatever run of messages that brings into order
+void receive_data(struct sr_conn *c, int side, struct pkt *packet) {
+  struct sr_side *s = &c->side[side];
+  struct recvwindow *window = &s->window;
+  TRACE_LOG(TRACE_DEBUG, "%c%d received packet:\n\tSeqnum: %d\n\tPayload: %.20s\n", 'A' + side, c->id, packet->seqnum, packet->payload);
+  // Ignore packets outside both the receive window and the window just before it;
+  // the sender can't have sent those, or already knows they arrived
+  int offset = seq_diff(packet->seqnum, window->expected);
+  TRACE_EVENT(TRACE_RECEIVE, c->id, side, packet->seqnum, offset);
+  if (offset >= winsize || offset < -winsize) return;
+  if (offset == 0 && window->size == 0) {
+    TRACE_LOG(TRACE_DEBUG, "\tSending up: %.20s\n", packet->payload);
+    deliver(c, side, &packet->payload, 1);
+    TRACE_EVENT(TRACE_DELIVER, c->id, side, window->expected, 1);
+    metrics_count(&s->metrics, METRIC_DELIVERED);
+    window->expected++;
+  }
+  else if (offset >= 0 && !window->present[recv_slot(window, packet->seqnum)]) {
+    int slot = recv_slot(window, packet->seqnum);
+    memcpy(window->payloads[slot], packet->payload, sizeof(window->payloads[slot]));
+    window->present[slot] = 1;
+    window->size++;
+    if (offset == 0) deliver_run(c, side);
+  }
+  schedule_ack(c, side, packet, offset);
+}
+
+// Queue a message from layer 5 for sending; if the window isn't full, send it right away.
+// Returns SEND_WOULDBLOCK, without taking the message, if the send buffer is full.
+int side_output(struct sr_conn *c, int side, struct msg *message) {
+  struct sr_side *s = &c->side[side];
+  if (!sack_acks && side == 1) {
+    fprintf(stderr, "sr: with per-packet acks only A can send data; B's would look like acks\n");
+    exit(2);
+  }
+  if (sendbuf_admit(&s->sendbuf) == SEND_WOULDBLOCK) return SEND_WOULDBLOCK;
+  TRACE_LOG(TRACE_DEBUG, "%c%d got message: %.20s\n", 'A' + side, c->id, message->data);
   // Create packet for message
-  struct pkt *new_pkt = (struct pkt *) malloc(sizeof(struct pkt));
-  new_pkt->seqnum = next_seqnum;
-  next_seqnum++;
-  new_pkt->acknum = 0;
-  new_pkt->checksum = new_pkt->seqnum;
-  for (int i=0;i<20;i++) {
-    new_pkt->checksum += message.data[i];
-    new_pkt->payload[i] = message.data[i];
-  }
-  // If window isn't full, add this packet and send
-  if (window->size < winsize) {
-    tolayer3(0, *new_pkt);
-    queue(window, new_pkt);
-    if (current_timer == NULL) {
-      starttimer(0, RTT + (5*winsize));
-      current_timer = window->front;
-      }
+  struct pkt *new_pkt = (struct pkt *) pool_acquire(&s->pool);
+  make_pkt(new_pkt, (int) s->ring.nextseq, 0, message->data);
+  ring_push(&s->ring, new_pkt);
+  metrics_gauge(&s->metrics, METRIC_SEND_QUEUE, s->sendbuf.stats.depth);
+  metrics_gauge(&s->metrics, METRIC_POOL, s->pool.in_use);
+  if (seq_diff(s->ring.nextsend, s->ring.base) < send_limit(s)) {
+    send_next(c, side);
+    timer_sync(c, side);
   }
-  // Else, add to queue
-  else queue(a_queue, new_pkt);
+  return SEND_OK;
 }
 
-/* called from layer 3, when a packet arrives for layer 4 */
-void A_input(packet)
-  struct pkt packet;
-{
-  printf("A got ack back\n");
-  fflush(NULL);
-  //Validate checksum
-  int check = packet.acknum + packet.seqnum;
-  for (int i=0;i<20;i++) check += packet.payload[i];
-  if (check == packet.checksum) {
-    printf("\tAck number %d, message: %.20s\n", packet.acknum, packet.payload);
-    fflush(NULL);
-    // Find window element associated with this ack
-    struct queue_elem *window_elem = window->front;
-    while (window_elem != NULL && window_elem->pkt->seqnum != packet.seqnum) {
-      window_elem = window_elem->next;
+// Handle a packet from layer 3: an ack for what this side sent, or data from the
+// other side with an ack for what this side sent riding in acknum
+void side_input(struct sr_conn *c, int side, struct pkt *packet) {
+  struct sr_side *s = &c->side[side];
+  int kind = pkt_kind(packet);
+  // Per-packet acks are unmarked, but then A only ever gets acks
+  if (!sack_acks && side == 0 && kind == PKT_DATA) kind = PKT_ACK;
+  if (kind == PKT_CORRUPT) {
+    metrics_count(&s->metrics, METRIC_CORRUPTED);
+    TRACE_EVENT(TRACE_CORRUPT, c->id, side, packet->seqnum, packet->acknum);
+    return;
+  }
+  if (kind == PKT_DATA) {
+    // Take the data first, so whatever the piggybacked ack frees up to send
+    // carries the ack for it. That ack is cumulative only; time the newest
+    // packet it covers.
+    receive_data(c, side, packet);
+    unsigned int cumulative = packet->acknum;
+    if (seq_diff(cumulative, s->ring.base) > 0 && ack_cumulative(s, cumulative, cumulative - 1) >= 0) {
+      metrics_count(&s->metrics, METRIC_ACKS);
+      TRACE_EVENT(TRACE_ACK, c->id, side, cumulative, cumulative - 1);
+      slide_window(c, side);
+    }
+    return;
+  }
+  TRACE_EVENT(TRACE_ACK, c->id, side, packet->acknum, packet->seqnum);
+  TRACE_LOG(TRACE_DEBUG, "%c%d got ack back\n", 'A' + side, c->id);
+  metrics_count(&s->metrics, METRIC_ACKS);
+  int acked = 0;
+  if (sack_acks) {
+    TRACE_LOG(TRACE_DEBUG, "\tCumulative ack %d, triggered by %d\n", packet->acknum, packet->seqnum);
+    unsigned int cumulative = packet->acknum;
+    acked = ack_cumulative(s, cumulative, packet->seqnum);
+    if (acked < 0) return;
+    // Then whatever the other side is holding out of order, noting which of those
+    // are new (bit i+1 of fresh for cumulative+1+i) for fast retransmit
+    char fresh[SACK_BITS/8 + 1] = {0};
+    int count = 0;
+    int span = 0;
+    float newest = 0;
+    for (int i = 0; i < SACK_BITS; i++) {
+      if (packet->payload[i/8] == 0) {
+        i += 7;
+        continue;
+      }
+      unsigned int seq = cumulative + 1 + i;
+      if ((packet->payload[i/8] & (1 << (i%8))) && in_window(&s->ring, seq)
+          && ack_slot(s, seq, seq == (unsigned int) packet->seqnum)) {
+        acked++;
+        fresh[(i+1)/8] |= 1 << ((i+1)%8);
+        count++;
+        span = i + 2;
+        float sent = ring_slot(&s->ring, seq)->time_sent;
+        if (sent > newest) newest = sent;
+      }
     }
-    if (window_elem == NULL) return;
-    printf("\tWindow element: %.20s\n", window_elem->pkt->payload);
-    fflush(NULL);
-    // Update window element status
-    window_elem->status = 1;
-
-    // While window front is a received packet:
-    while (window->size != 0 && window->front->status == 1) {
-      printf("\tWindow front:\n\t\tMessage: %.20s\n\t\tStatus: %d\n", window->front->pkt->payload, window->front->status);
-      fflush(NULL);
-      // remove front from window
-      struct pkt *del = dequeue(window);
-      free(del);
-      // send next packet and add to window
-      printf("\ta_queue size: %d, window size: %d\n", a_queue->size, window->size);
-      fflush(NULL);
-      if (a_queue->size != 0) {
-        struct pkt *new_pkt = dequeue(a_queue);
-        tolayer3(0, *new_pkt);
-        queue(window, new_pkt);
-        if (current_timer == NULL) {
-          starttimer(0, RTT + (5*winsize));
-          current_timer = window->front;
-        }
+    if (fast_retransmit_acks > 0 && count > 0) later_acks(c, side, cumulative, span, fresh, count, newest);
+  }
+  else {
+    TRACE_LOG(TRACE_DEBUG, "\tAck number %d, message: %.20s\n", packet->acknum, packet->payload);
+    // Find window element associated with this ack
+    if (in_window(&s->ring, packet->seqnum) && ack_slot(s, packet->seqnum, 1)) {
+      acked = 1;
+      if (fast_retransmit_acks > 0) {
+        later_acks(c, side, s->ring.base, seq_diff(packet->seqnum, s->ring.base), NULL, 1,
+                   ring_slot(&s->ring, packet->seqnum)->time_sent);
       }
     }
+  }
+  if (acked == 0) {
+    metrics_count(&s->metrics, METRIC_DUP_ACKS);
+    return;
+  }
+  slide_window(c, side);
+}
 
-    // If this window element is the current timed packet:
-    if (current_timer == NULL) current_timer = window->front;
-    if (current_timer == window_elem) {
-      printf("\tResetting current timer\n");
-      fflush(NULL);
-      // Stop timer
-      stoptimer(0);
-      // Get next packet to time
-      current_timer = next_timer(window, current_timer);
-      // Start timer for this packet
-      if (current_timer != NULL && current_timer->status == 0) starttimer(0, (RTT+(5*winsize))-(get_sim_time()-current_timer->time_sent));
+// A side's timer went off: resend every packet whose deadline has passed, and send
+// the ack it owes if that has waited long enough
+void side_timer(struct sr_conn *c, int side) {
+  struct sr_side *s = &c->side[side];
+  struct timerheap *timers = &s->timers;
+  timers->running = 0;
+  TRACE_EVENT(TRACE_TIMER, c->id, side, s->ring.base, timers->size);
+  while (timers->size != 0 && heap_deadline(timers, 0) <= get_sim_time() + TIMER_SLACK) {
+    unsigned int seqnum = timers->seqs[0];
+    struct queue_elem *timed = ring_slot(&s->ring, seqnum);
+    // The deadline was set with the timeout at send time; if the estimate has
+    // grown since, wait out the rest instead of resending early
+    float due = timed->time_sent + rtt_retry_timeout(&s->rtt, timed->retries);
+    if (due > get_sim_time() + TIMER_SLACK) {
+      timer_arm(timers, seqnum, due);
+      continue;
     }
+    TRACE_LOG(TRACE_INFO, "Timer interrupt for packet %u on connection %d side %c\n", seqnum, c->id, 'A' + side);
+    if (congestion_control) cwnd_loss(s, seqnum, 1);
+    send_data(c, side, timed->pkt);
+    metrics_count(&s->metrics, METRIC_RETRANSMITTED);
+    // Each retry of this packet doubles its own timeout, and it may be fast
+    // retransmitted again
+    timed->retries++;
+    timed->fast = 0;
+    TRACE_EVENT(TRACE_RETRANSMIT, c->id, side, seqnum, timed->retries);
+    timed->time_sent = get_sim_time();
+    timer_arm(timers, seqnum, timed->time_sent + rtt_retry_timeout(&s->rtt, timed->retries));
+    TRACE_LOG(TRACE_INFO, "\tNext timeout %.2f\n", rtt_retry_timeout(&s->rtt, timed->retries));
   }
+  trace_cwnd(c, side);
+  // No data went out to carry the ack in time, so it goes on its own
+  if (s->ack_pending && s->ack_deadline <= get_sim_time() + TIMER_SLACK) send_sack(c, side, s->ack_echo);
+  // Start timer for the next deadline
+  timer_sync(c, side);
+}
+
+// Set up one side of a connection, creating the connection if it is new
+void side_init(int conn, int side) {
+  trace_init();
+  winsize = getwinsize();
+  const char *cc = getenv("SR_CC");
+  if (cc != NULL && cc[0] != '\0') congestion_control = atoi(cc);
+  const char *fast = getenv("SR_FAST_RETRANSMIT");
+  if (fast != NULL && fast[0] != '\0') fast_retransmit_acks = atoi(fast);
+  const char *batch = getenv("SR_BATCH_DELIVERY");
+  if (batch != NULL && batch[0] != '\0') batch_delivery = atoi(batch);
+  const char *delay = getenv("SR_ACK_DELAY");
+  if (delay != NULL && delay[0] != '\0') ack_delay = atof(delay);
+  if (conns.size == 0) conn_table_init(&conns, sizeof(struct sr_conn));
+  struct sr_conn *c = (struct sr_conn *) conn_add(&conns, conn);
+  c->id = conn;
+  struct sr_side *s = &c->side[side];
+  // Start small so thousands of idle connections stay cheap; the ring grows
+  // when a connection queues more
+  s->ring.capacity = pow2_capacity(2 * winsize);
+  s->ring.slots = (struct queue_elem *) calloc(s->ring.capacity, sizeof(struct queue_elem));
+  s->ring.base = 0;
+  s->ring.nextsend = 0;
+  s->ring.nextseq = 0;
+  s->timers.ring = &s->ring;
+  s->timers.seqs = (unsigned int *) malloc(winsize * sizeof(unsigned int));
+  s->timers.size = 0;
+  s->timers.running = 0;
+  rtt_init(&s->rtt, RTT + (5*winsize));
+  s->cwnd = INITIAL_CWND < winsize ? INITIAL_CWND : winsize;
+  s->ssthresh = winsize;
+  s->recover = 0;
+  s->cwnd_traced = (int) s->cwnd;
+  s->fast_retransmits = 0;
+  s->reordering = fast_retransmit_acks;
+  metrics_init(&s->metrics);
+  // A buffer smaller than the window would keep the window from ever filling
+  int high, low;
+  getwatermarks(&high, &low);
+  if (high != 0 && high < winsize) {
+    static int warned;
+    if (!warned) {
+      fprintf(stderr, "sr: high watermark %d is below the window size %d; using %d:%d\n", high, winsize, winsize, winsize / 2);
+      warned = 1;
+    }
+    high = winsize;
+    low = winsize / 2;
+  }
+  sendbuf_init(&s->sendbuf, high, low);
+  // Every message the send buffer admits holds a packet until it is acked, so
+  // size the pool for a full buffer and it never has to grow
+  pool_init(&s->pool, sizeof(struct pkt), high > 2 * winsize ? high : 2 * winsize);
+  s->window.capacity = pow2_capacity(winsize);
+  s->window.payloads = (char (*)[20]) malloc(s->window.capacity * sizeof(*s->window.payloads));
+  s->window.present = (unsigned char *) calloc(s->window.capacity, 1);
+  s->window.size = 0;
+  s->window.expected = 0;
+  s->acks = 0;
+  s->ack_pending = 0;
+}
+
+/********* STUDENTS WRITE THE NEXT SEVEN ROUTINES *********/
+
+/* called from layer 5, passed the data to be sent to other side */
+int conn_A_output(conn, message)
+  int conn;
+  struct msg message;
+{
+  return side_output((struct sr_conn *) conn_find(&conns, conn), 0, &message);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 */
+void conn_A_input(conn, packet)
+  int conn;
+  struct pkt packet;
+{
+  side_input((struct sr_conn *) conn_find(&conns, conn), 0, &packet);
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt()
+void conn_A_timerinterrupt(conn)
+  int conn;
 {
-  printf("Timer interrupt for packet %d\n", current_timer->pkt->seqnum);
-  fflush(NULL);
-  // Resend this packet
-  tolayer3(0, *(current_timer->pkt));
-  // Reset time sent for packet
-  current_timer->time_sent = get_sim_time();
-  // Get next packet to time
-  current_timer = next_timer(window, current_timer);
-  // Start timer for this packet
-  if (current_timer != NULL) {
-    starttimer(0, (RTT  +(5*winsize))-(get_sim_time()-current_timer->time_sent));
-    printf("\tNew timer for packet %d\n", current_timer->pkt->seqnum);
-    fflush(NULL);
-    }
-}  
+  side_timer((struct sr_conn *) conn_find(&conns, conn), 0);
+}
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init()
+void conn_A_init(conn)
+  int conn;
 {
-  a_queue = (struct pktqueue *) malloc(sizeof(struct pktqueue));
-  window = (struct pktqueue *) malloc(sizeof(struct pktqueue));
-  winsize = getwinsize();
-  next_seqnum = 0;
-  current_timer = NULL;
+  side_init(conn, 0);
 }
 
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
+/* Both sides send data, so B mirrors A: B_output() sends to A */
+int conn_B_output(conn, message)
+  int conn;
+  struct msg message;
+{
+  return side_output((struct sr_conn *) conn_find(&conns, conn), 1, &message);
+}
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(packet)
+void conn_B_input(conn, packet)
+  int conn;
   struct pkt packet;
 {
-  //Validate checksum
-  int check = packet.acknum + packet.seqnum;
-  for (int i=0;i<20;i++) check += packet.payload[i];
-  if (check == packet.checksum) {
-    printf("B received packet:\n\tSeqnum: %d\n\tPayload: %.20s\n", packet.seqnum, packet.payload);
-    fflush(NULL);
-    // Create ack message
-    struct pkt *new_ack = (struct pkt *) malloc(sizeof(struct pkt));
-    new_ack->acknum = b_acks;
-    new_ack->seqnum = packet.seqnum;
-    new_ack->checksum = b_acks + packet.seqnum;
-    b_acks++;
-    for (int i=0;i<20;i++) {
-      new_ack->checksum += packet.payload[i];
-      new_ack->payload[i] = packet.payload[i];
-    }
-    // Set new ack as package in b buffer
-    if (b_buffer[packet.seqnum] != NULL) free(b_buffer[packet.seqnum]);
-    b_buffer[packet.seqnum] = new_ack;
-    // Send ack back to A
-    tolayer3(1, *new_ack);
-    // Store all possible messages
-    while (b_buffer[b_nextstore] != NULL) {
-      printf("\tSending up: %.20s\n", b_buffer[b_nextstore]->payload);
-      tolayer5(1, b_buffer[b_nextstore]->payload);
-      // free(b_buffer[b_nextstore]);
-      b_nextstore++;
-    }
-  }
+  side_input((struct sr_conn *) conn_find(&conns, conn), 1, &packet);
+}
+
+/* called when B's timer goes off */
+void conn_B_timerinterrupt(conn)
+  int conn;
+{
+  side_timer((struct sr_conn *) conn_find(&conns, conn), 1);
 }
 
 /* the following rouytine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
+void conn_B_init(conn)
+  int conn;
+{
+  side_init(conn, 1);
+}
+
+/* sender statistics for the emulator's summary */
+void conn_sendstats(conn, AorB, stats)
+  int conn;
+  int AorB;
+  struct sendstats *stats;
+{
+  struct sr_side *s = &((struct sr_conn *) conn_find(&conns, conn))->side[AorB];
+  sendbuf_stats(&s->sendbuf, stats);
+  stats->fast_retransmits = s->fast_retransmits;
+}
+
+/* protocol state for the emulator's -v dump */
+void conn_print(conn, AorB, out)
+  int conn;
+  int AorB;
+  FILE *out;
+{
+  struct sr_side *s = &((struct sr_conn *) conn_find(&conns, conn))->side[AorB];
+  fprintf(out, "conn %d %c rtt ", conn, 'A' + AorB);
+  rtt_print(&s->rtt, out);
+  fprintf(out, "conn %d %c packet pool ", conn, 'A' + AorB);
+  pool_print(&s->pool, out);
+}
+
+/* live metrics for one side of a connection */
+struct metrics *conn_metrics(conn, AorB)
+  int conn;
+  int AorB;
+{
+  return &((struct sr_conn *) conn_find(&conns, conn))->side[AorB].metrics;
+}
+
+/* PA2 entry points: a single connection, number 0 */
+void A_output(message)
+  struct msg message;
+{
+  conn_A_output(0, message);
+}
+
+void A_input(packet)
+  struct pkt packet;
+{
+  conn_A_input(0, packet);
+}
+
+void A_timerinterrupt()
+{
+  conn_A_timerinterrupt(0);
+}
+
+void A_init()
+{
+  conn_A_init(0);
+}
+
+void B_output(message)
+  struct msg message;
+{
+  conn_B_output(0, message);
+}
+
+void B_input(packet)
+  struct pkt packet;
+{
+  conn_B_input(0, packet);
+}
+
+void B_timerinterrupt()
+{
+  conn_B_timerinterrupt(0);
+}
+
 void B_init()
 {
-  b_buffer = calloc(BUFFERSIZE, sizeof(struct pkt *));
-  b_acks = 0;
-  b_nextstore = 0;
+  conn_B_init(0);
 }
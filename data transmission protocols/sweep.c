@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* ******************************************************************
+ Benchmark sweep over protocol x loss rate x window size.
+
+   Runs every combination as its own emulator process, as many at a
+   time as there are cores, and prints one CSV row per run in a fixed
+   order. Each row has the goodput (messages delivered per simulated time
+   unit), packets sent per message, the retransmission ratio, delivery
+   latency percentiles and how many emulator events per wall-clock
+   second the run processed. ABT has no window, so it runs once per loss
+   rate. The runs inherit the environment, so SR_CC=1 ./sweep gives the
+   congestion-controlled SR numbers to set against the fixed-window ones.
+
+   Usage: ./sweep [options]
+     -p LIST   protocols (default abt,gbn,sr)
+     -l LIST   loss rates, also used as corruption rates with -C (default 0,0.05,0.1,0.2)
+     -w LIST   window sizes (default 1,8,32,128)
+     -C        corrupt packets at the same rate they are lost
+     -B        bidirectional runs (protocols with B_output only)
+     -m N      messages per run (default 20000)
+     -t T      mean time between messages (default 5)
+     -s N      random seed (default 1)
+     -j N      parallel runs (default: number of online cores)
+     -b DIR    directory holding the protocol binaries (default .)
+**********************************************************************/
+
+#define MAXLIST 32
+#define MAXRESULT 1024
+
+struct run {
+    char protocol[16];
+    char loss[16];
+    int window;
+    pid_t pid;
+    int fd;             // read end of the run's stderr
+    int status;
+    char result[MAXRESULT];
+};
+
+// Split a comma separated list into at most MAXLIST entries
+int split(char *list, char **items) {
+    int n = 0;
+    for (char *item = strtok(list, ","); item != NULL && n < MAXLIST; item = strtok(NULL, ",")) items[n++] = item;
+    return n;
+}
+
+// Copy the value of key=value out of a result line, or "" if it isn't there
+void field(const char *result, const char *key, char *out, size_t size) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "%s=", key);
+    const char *p = result;
+    out[0] = '\0';
+    while ((p = strstr(p, pattern)) != NULL) {
+        if (p == result || p[-1] == ' ') {
+            p += strlen(pattern);
+            size_t n = strcspn(p, " \n");
+            if (n >= size) n = size - 1;
+            memcpy(out, p, n);
+            out[n] = '\0';
+            return;
+        }
+        p++;
+    }
+}
+
+void start_run(struct run *run, const char *bindir, const char *msgs, const char *interarrival,
+               const char *seed, int corrupt, int bidirectional) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    run->pid = fork();
+    if (run->pid == 0) {
+        char path[512], window[16];
+        snprintf(path, sizeof(path), "%s/%s", bindir, run->protocol);
+        snprintf(window, sizeof(window), "%d", run->window);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        char *args[16] = {path, "-m", (char *) msgs, "-t", (char *) interarrival, "-s", (char *) seed,
+                          "-w", window, "-l", run->loss};
+        int n = 11;
+        if (corrupt) {
+            args[n++] = "-c";
+            args[n++] = run->loss;
+        }
+        if (bidirectional) args[n++] = "-b";
+        args[n] = NULL;
+        execv(path, args);
+        fprintf(stderr, "cannot run %s\n", path);
+        _exit(127);
+    }
+    close(fds[1]);
+    run->fd = fds[0];
+}
+
+// Collect a finished run's summary line
+void finish_run(struct run *run, int status) {
+    size_t used = 0;
+    ssize_t n;
+    while ((n = read(run->fd, run->result + used, MAXRESULT - 1 - used)) > 0) used += n;
+    run->result[used] = '\0';
+    close(run->fd);
+    // Keep only the last line, which is the summary
+    char *last = run->result;
+    for (char *p = run->result; *p; p++) if (*p == '\n' && p[1] != '\0') last = p + 1;
+    memmove(run->result, last, strlen(last) + 1);
+    run->status = status;
+}
+
+double wall_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    char protocols[256] = "abt,gbn,sr";
+    char losses[256] = "0,0.05,0.1,0.2";
+    char windows[256] = "1,8,32,128";
+    const char *msgs = "20000";
+    const char *interarrival = "5";
+    const char *seed = "1";
+    const char *bindir = ".";
+    int corrupt = 0;
+    int bidirectional = 0;
+    int jobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:w:CBm:t:s:j:b:")) != -1) {
+        switch (opt) {
+            case 'p': snprintf(protocols, sizeof(protocols), "%s", optarg); break;
+            case 'l': snprintf(losses, sizeof(losses), "%s", optarg); break;
+            case 'w': snprintf(windows, sizeof(windows), "%s", optarg); break;
+            case 'C': corrupt = 1; break;
+            case 'B': bidirectional = 1; break;
+            case 'm': msgs = optarg; break;
+            case 't': interarrival = optarg; break;
+            case 's': seed = optarg; break;
+            case 'j': jobs = atoi(optarg); break;
+            case 'b': bindir = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-p protocols] [-l losses] [-w windows] [-C] [-B] [-m msgs]"
+                        " [-t interarrival] [-s seed] [-j jobs] [-b bindir]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (jobs < 1) jobs = 1;
+
+    char *plist[MAXLIST], *llist[MAXLIST], *wlist[MAXLIST];
+    int np = split(protocols, plist);
+    int nl = split(losses, llist);
+    int nw = split(windows, wlist);
+
+    // Build the run list in output order
+    struct run *runs = (struct run *) calloc(np * nl * nw, sizeof(struct run));
+    int nruns = 0;
+    for (int p = 0; p < np; p++) {
+        for (int l = 0; l < nl; l++) {
+            for (int w = 0; w < nw; w++) {
+                if (strcmp(plist[p], "abt") == 0 && w > 0) break;
+                struct run *run = &runs[nruns++];
+                snprintf(run->protocol, sizeof(run->protocol), "%s", plist[p]);
+                snprintf(run->loss, sizeof(run->loss), "%s", llist[l]);
+                run->window = strcmp(plist[p], "abt") == 0 ? 1 : atoi(wlist[w]);
+                run->pid = 0;
+            }
+        }
+    }
+
+    // Keep up to jobs runs going until they've all finished
+    double start = wall_seconds();
+    int next = 0, running = 0, failed = 0;
+    while (next < nruns || running > 0) {
+        while (next < nruns && running < jobs) {
+            start_run(&runs[next++], bindir, msgs, interarrival, seed, corrupt, bidirectional);
+            running++;
+        }
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0) break;
+        for (int i = 0; i < next; i++) {
+            if (runs[i].pid == pid) {
+                finish_run(&runs[i], status);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+                running--;
+                break;
+            }
+        }
+    }
+    double wall = wall_seconds() - start;
+
+    printf("protocol,loss,corrupt,window,delivered,goodput,pkts_per_msg,retx_ratio,lat_p50,lat_p90,lat_p99,events,events_per_sec,ok\n");
+    long total_events = 0;
+    for (int i = 0; i < nruns; i++) {
+        struct run *run = &runs[i];
+        char delivered[32], goodput[32], per_msg[32], retx[32], p50[32], p90[32], p99[32], events[32], eps[32];
+        field(run->result, "delivered", delivered, sizeof(delivered));
+        field(run->result, "goodput", goodput, sizeof(goodput));
+        field(run->result, "pkts_per_msg", per_msg, sizeof(per_msg));
+        field(run->result, "retx_ratio", retx, sizeof(retx));
+        field(run->result, "lat_p50", p50, sizeof(p50));
+        field(run->result, "lat_p90", p90, sizeof(p90));
+        field(run->result, "lat_p99", p99, sizeof(p99));
+        field(run->result, "events", events, sizeof(events));
+        field(run->result, "events_per_sec", eps, sizeof(eps));
+        total_events += atol(events);
+        int ok = WIFEXITED(run->status) && WEXITSTATUS(run->status) == 0;
+        printf("%s,%s,%s,%d,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n", run->protocol, run->loss, corrupt ? run->loss : "0",
+               run->window, delivered, goodput, per_msg, retx, p50, p90, p99, events, eps, ok ? "yes" : "no");
+    }
+    fprintf(stderr, "%d runs on %d cores in %.2f s, %.0f events/s overall, %d failed\n",
+            nruns, jobs, wall, wall > 0 ? total_events / wall : 0, failed);
+    free(runs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+#include "trace.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int trace_level = TRACE_OFF;
+__thread struct trace_buffer *trace_buffer;
+
+// Every thread's ring, newest first
+static struct trace_buffer *buffers;
+
+static int initialized;
+static const char *dump_path;
+
+static const char *type_names[TRACE_TYPES] = {
+    "send", "retransmit", "ack", "timer", "receive", "deliver", "corrupt", "window", "fast"
+};
+
+static void dump_at_exit() {
+    if (trace_dump(dump_path) != 0) fprintf(stderr, "cannot write trace to %s\n", dump_path);
+}
+
+void trace_init() {
+    if (initialized) return;
+    initialized = 1;
+    const char *level = getenv("TRACE_LEVEL");
+    if (level != NULL) trace_level = atoi(level);
+    dump_path = getenv("TRACE_DUMP");
+    if (dump_path != NULL && dump_path[0] != '\0') atexit(dump_at_exit);
+}
+
+void trace_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stdout, format, args);
+    va_end(args);
+}
+
+struct trace_buffer *trace_buffer_new() {
+    struct trace_buffer *buffer = (struct trace_buffer *) calloc(1, sizeof(struct trace_buffer));
+    // Push onto the list without a lock; shards can start tracing at the same time
+    buffer->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers, &buffer->next, buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    trace_buffer = buffer;
+    return buffer;
+}
+
+// Records a ring still holds: once it has wrapped, only the last TRACE_RING_SIZE
+static uint32_t kept(struct trace_buffer *buffer) {
+    return buffer->count < TRACE_RING_SIZE ? (uint32_t) buffer->count : TRACE_RING_SIZE;
+}
+
+// Call once every tracing thread has finished
+int trace_dump(const char *path) {
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) return -1;
+    struct trace_header header;
+    memcpy(header.magic, "TRC1", 4);
+    header.count = 0;
+    header.total = 0;
+    int nbuffers = 0;
+    for (struct trace_buffer *b = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+        header.count += kept(b);
+        header.total += b->count;
+        nbuffers++;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    // Merge the rings by time, each read oldest record first: once a ring has
+    // wrapped, that is the next one it would overwrite. There is a ring per
+    // shard, so a linear scan for the earliest is cheap.
+    struct trace_buffer **ring = (struct trace_buffer **) malloc((nbuffers > 0 ? nbuffers : 1) * sizeof(*ring));
+    uint64_t *next = (uint64_t *) malloc((nbuffers > 0 ? nbuffers : 1) * sizeof(*next));
+    int i = 0;
+    for (struct trace_buffer *b = buffers; b != NULL; b = b->next, i++) {
+        ring[i] = b;
+        next[i] = b->count - kept(b);
+    }
+    for (uint32_t written = 0; written < header.count; written++) {
+        struct trace_record *earliest = NULL;
+        int from = 0;
+        for (i = 0; i < nbuffers; i++) {
+            if (next[i] == ring[i]->count) continue;
+            struct trace_record *record = &ring[i]->ring[next[i] & (TRACE_RING_SIZE - 1)];
+            if (earliest == NULL || record->time < earliest->time) {
+                earliest = record;
+                from = i;
+            }
+        }
+        fwrite(earliest, sizeof(struct trace_record), 1, out);
+        next[from]++;
+    }
+    free(ring);
+    free(next);
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+const char *trace_type_name(int type) {
+    if (type < 0 || type >= TRACE_TYPES) return "unknown";
+    return type_names[type];
+}
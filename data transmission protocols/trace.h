@@ -0,0 +1,115 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "simulator.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* ******************************************************************
+ Protocol tracing without stdio on the hot path.
+
+   Two kinds of trace, each removable at compile time:
+   - TRACE_LOG writes a formatted line to stdout if its level is at or
+     below both TRACE_LEVEL (compile time) and trace_level (run time).
+     Building with -DTRACE_LEVEL=0 compiles every call away. Lines are
+     not flushed; stdout is flushed once at exit.
+   - TRACE_EVENT appends a fixed 16-byte record to an in-memory ring
+     holding the last TRACE_RING_SIZE events. Building with
+     -DTRACE_RING=0 compiles every call away. Each thread traces into
+     a ring of its own, so shards never share one; trace_dump() merges
+     the rings by time into a file for trace_decode to print.
+
+   trace_init() reads the run time settings from the environment:
+     TRACE_LEVEL=N     log level (default 0, nothing logged)
+     TRACE_DUMP=FILE   dump the event ring to FILE at exit
+**********************************************************************/
+
+#define TRACE_OFF 0
+#define TRACE_INFO 1
+#define TRACE_DEBUG 2
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_DEBUG
+#endif
+
+#ifndef TRACE_RING
+#define TRACE_RING 1
+#endif
+
+#define TRACE_RING_SIZE 65536   // records kept, a power of two
+
+// Event types in the ring
+enum trace_type {
+    TRACE_SEND,         // packet first put on the wire; arg is the window size after
+    TRACE_RETRANSMIT,   // packet sent again; arg is its retry count
+    TRACE_ACK,          // ack accepted; seq is the cumulative ack, arg the seqnum that triggered it
+    TRACE_TIMER,        // timer went off; arg is the number of timers still pending
+    TRACE_RECEIVE,      // data packet accepted; arg is its offset from the next expected seqnum
+    TRACE_DELIVER,      // messages handed to layer 5; seq is the first, arg how many
+    TRACE_CORRUPT,      // packet dropped for a bad checksum
+    TRACE_WINDOW,       // congestion window changed; seq is the slow start threshold, arg the window
+    TRACE_FAST,         // packet resent ahead of its timer; arg is how many later packets were acked
+    TRACE_TYPES
+};
+
+// On-disk and in-memory record
+struct trace_record {
+    float time;         // simulator time
+    uint8_t type;       // enum trace_type
+    uint8_t side;       // 0 for A, 1 for B
+    uint16_t conn;      // connection ID, modulo 65536
+    uint32_t seq;
+    uint32_t arg;
+};
+
+// Dump file header, followed by count records
+struct trace_header {
+    char magic[4];      // "TRC1"
+    uint32_t count;     // records in the file
+    uint64_t total;     // records ever traced, including overwritten ones
+};
+
+// One thread's event ring
+struct trace_buffer {
+    struct trace_buffer *next;  // the ring of the thread that started tracing before this one
+    uint64_t count;             // records ever traced into this ring
+    struct trace_record ring[TRACE_RING_SIZE];
+};
+
+extern int trace_level;
+extern __thread struct trace_buffer *trace_buffer;
+
+#define TRACE_LOG(level, ...) \
+    do { if ((level) <= TRACE_LEVEL && (level) <= trace_level) trace_printf(__VA_ARGS__); } while (0)
+
+#define TRACE_EVENT(type, conn, side, seq, arg) \
+    do { if (TRACE_RING) trace_event(type, conn, side, seq, arg); } while (0)
+
+// Read the environment settings; safe to call more than once
+void trace_init();
+
+// printf to stdout, for TRACE_LOG
+void trace_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Write every thread's events to a file, oldest record first. Returns 0 on success.
+int trace_dump(const char *path);
+
+// Give the calling thread a ring of its own, for trace_event
+struct trace_buffer *trace_buffer_new();
+
+// Name of an event type
+const char *trace_type_name(int type);
+
+// Append a record to the calling thread's event ring, for TRACE_EVENT
+static inline void trace_event(int type, int conn, int side, unsigned int seq, unsigned int arg) {
+    struct trace_buffer *buffer = trace_buffer != NULL ? trace_buffer : trace_buffer_new();
+    struct trace_record *record = &buffer->ring[buffer->count++ & (TRACE_RING_SIZE - 1)];
+    record->time = get_sim_time();
+    record->type = (uint8_t) type;
+    record->side = (uint8_t) side;
+    record->conn = (uint16_t) conn;
+    record->seq = seq;
+    record->arg = arg;
+}
+
+#endif
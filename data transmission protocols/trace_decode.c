@@ -0,0 +1,61 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ******************************************************************
+ Offline decoder for event rings written by trace_dump().
+
+   Usage: ./trace_decode [-t type] [-c conn] FILE
+     -t TYPE   only print events of this type (send, ack, timer, ...)
+     -c CONN   only print events on this connection
+
+   Prints one line per event: time, connection, side, event, seqnum,
+   argument, then a count of each event type.
+**********************************************************************/
+
+int main(int argc, char **argv) {
+    const char *only = NULL;
+    int conn = -1;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) only = argv[++i];
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) conn = atoi(argv[++i]);
+        else path = argv[i];
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s [-t type] [-c conn] file\n", argv[0]);
+        return 2;
+    }
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        perror(path);
+        return 1;
+    }
+    struct trace_header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, "TRC1", 4) != 0) {
+        fprintf(stderr, "%s: not a trace dump\n", path);
+        return 1;
+    }
+
+    long counts[TRACE_TYPES + 1] = {0};
+    struct trace_record record;
+    uint32_t read = 0;
+    while (read < header.count && fread(&record, sizeof(record), 1, in) == 1) {
+        read++;
+        int type = record.type < TRACE_TYPES ? record.type : TRACE_TYPES;
+        counts[type]++;
+        if (only != NULL && strcmp(only, trace_type_name(record.type)) != 0) continue;
+        if (conn >= 0 && record.conn != conn) continue;
+        printf("%12.3f %5u %c %-10s %10u %10u\n", record.time, record.conn, record.side == 0 ? 'A' : 'B',
+               trace_type_name(record.type), record.seq, record.arg);
+    }
+    fclose(in);
+
+    printf("# %u of %llu events", read, (unsigned long long) header.total);
+    for (int type = 0; type <= TRACE_TYPES; type++) {
+        if (counts[type] != 0) printf(" %s=%ld", trace_type_name(type), counts[type]);
+    }
+    printf("\n");
+    return read == header.count ? 0 : 1;
+}